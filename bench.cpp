@@ -0,0 +1,613 @@
+#include "deque.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    template<typename Functor>
+    double measure_ms(Functor f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto finish = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(finish - start).count();
+    }
+
+    void report(const std::string& name, double milliseconds) {
+        std::cout << std::left << std::setw(48) << name << std::right << std::setw(10)
+                  << std::fixed << std::setprecision(2) << milliseconds << " ms\n";
+    }
+
+    // percentiles of per-operation times in nanoseconds, sorts `samples`
+    void report_latency(const std::string& name, std::vector<int64_t>& samples) {
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&](double p) {
+            return samples[static_cast<size_t>(p * static_cast<double>(samples.size() - 1))];
+        };
+        std::cout << std::left << std::setw(48) << name << std::right << " p50 " << percentile(0.5)
+                  << " p99 " << percentile(0.99) << " p99.9 " << percentile(0.999) << " p99.99 "
+                  << percentile(0.9999) << " max " << samples.back() << " ns\n";
+    }
+
+    // keeps the optimizer from dropping the measured work
+    volatile size_t sink = 0;
+
+    template<typename T>
+    struct LegacyChunks : DequePolicy {
+        static constexpr size_t chunk_bytes = 32 * sizeof(T);
+    };
+
+    struct Payload {
+        std::array<char, 4096> data{};
+    };
+
+    template<typename T, typename Policy>
+    void bench_chunk_policy(const std::string& name, size_t count) {
+        report(name + " push_back", measure_ms([&] {
+            Deque<T, std::allocator<T>, Policy> d;
+            for (size_t i = 0; i < count; ++i) {
+                d.push_back(T{});
+            }
+            sink = sink + d.size();
+        }));
+
+        Deque<T, std::allocator<T>, Policy> d(count);
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<size_t> dist(0, count - 1);
+        report(name + " random operator[]", measure_ms([&] {
+            size_t acc = 0;
+            for (size_t i = 0; i < count; ++i) {
+                acc += static_cast<size_t>(reinterpret_cast<const char&>(d[dist(gen)]));
+            }
+            sink = sink + acc;
+        }));
+    }
+
+    void bench_vector_of_deques(size_t deques, size_t elements) {
+        const Deque<int> prototype(elements, 1);
+
+        report("vector<Deque<int>> growth, moving reallocation", measure_ms([&] {
+            std::vector<Deque<int>> vec;
+            for (size_t i = 0; i < deques; ++i) {
+                vec.push_back(prototype);
+            }
+            sink = sink + vec.size();
+        }));
+
+        report("vector<Deque<int>> growth, copying reallocation", measure_ms([&] {
+            std::vector<Deque<int>> vec;
+            for (size_t i = 0; i < deques; ++i) {
+                // forces the element-wise copies a reallocation made before move support
+                if (vec.size() == vec.capacity()) {
+                    std::vector<Deque<int>> bigger;
+                    bigger.reserve(2 * vec.capacity() + 1);
+                    for (const auto& deque : vec) {
+                        bigger.push_back(deque);
+                    }
+                    vec.swap(bigger);
+                }
+                vec.push_back(prototype);
+            }
+            sink = sink + vec.size();
+        }));
+    }
+
+    struct Record {
+        uint64_t key;
+        uint32_t flags;
+        float value;
+    };
+
+    // the deque is refilled in place so that the chunks are warm and allocation is out of the picture
+    void bench_bulk_append(size_t rounds, size_t batches, size_t batch_size) {
+        std::vector<Record> batch(batch_size, Record{1, 2, 3.0F});
+        Deque<Record> d;
+
+        report("Deque<Record> ingest, push_back loop", measure_ms([&] {
+            for (size_t round = 0; round < rounds; ++round) {
+                d.assign({});
+                for (size_t i = 0; i < batches; ++i) {
+                    for (const auto& record : batch) {
+                        d.push_back(record);
+                    }
+                }
+                sink = sink + d.size();
+            }
+        }));
+
+        report("Deque<Record> ingest, append_range", measure_ms([&] {
+            for (size_t round = 0; round < rounds; ++round) {
+                d.assign({});
+                for (size_t i = 0; i < batches; ++i) {
+                    d.append_range(batch);
+                }
+                sink = sink + d.size();
+            }
+        }));
+    }
+
+    // same layout as int, but not trivially copyable, so shifting goes element by element
+    struct BoxedInt {
+        BoxedInt(int value) : value(value) {}
+        BoxedInt(const BoxedInt& other) : value(other.value) {}
+        BoxedInt& operator=(const BoxedInt& other) {
+            value = other.value;
+            return *this;
+        }
+        ~BoxedInt() = default;
+
+        int value;
+    };
+
+    template<typename T>
+    void bench_middle_edits(const std::string& name, size_t size, size_t edits) {
+        Deque<T> d(size, T(1));
+        std::mt19937 gen(7);
+        report(name + " random insert + erase", measure_ms([&] {
+            for (size_t i = 0; i < edits; ++i) {
+                auto pos = static_cast<ptrdiff_t>(gen() % size);
+                d.insert(d.begin() + pos, T(2));
+                d.erase(d.begin() + pos);
+            }
+            sink = sink + d.size();
+        }));
+    }
+
+    void bench_batch_erase(size_t size, size_t batch) {
+        report("100k Deque<int>, erase batch one by one", measure_ms([&] {
+            Deque<int> d(size, 1);
+            auto pos = static_cast<ptrdiff_t>(size / 3);
+            for (size_t i = 0; i < batch; ++i) {
+                d.erase(d.begin() + pos);
+            }
+            sink = sink + d.size();
+        }));
+
+        report("100k Deque<int>, erase batch as a range", measure_ms([&] {
+            Deque<int> d(size, 1);
+            auto pos = static_cast<ptrdiff_t>(size / 3);
+            d.erase(d.begin() + pos, d.begin() + pos + static_cast<ptrdiff_t>(batch));
+            sink = sink + d.size();
+        }));
+    }
+
+    void bench_filter(size_t size) {
+        auto is_stale = [](int item) { return item % 4 == 0; };
+
+        report("100k Deque<int>, filter with erase loop", measure_ms([&] {
+            Deque<int> d;
+            for (size_t i = 0; i < size; ++i) {
+                d.push_back(static_cast<int>(i));
+            }
+            for (auto it = d.begin(); it != d.end();) {
+                it = is_stale(*it) ? d.erase(it) : it + 1;
+            }
+            sink = sink + d.size();
+        }));
+
+        report("100k Deque<int>, filter with erase_if", measure_ms([&] {
+            Deque<int> d;
+            for (size_t i = 0; i < size; ++i) {
+                d.push_back(static_cast<int>(i));
+            }
+            sink = sink + erase_if(d, is_stale);
+        }));
+    }
+
+    void bench_accumulate(size_t size, size_t rounds) {
+        std::vector<double> vec(size, 1.5);
+        Deque<double> d(size, 1.5);
+
+        report("1M vector<double>, std::accumulate", measure_ms([&] {
+            double acc = 0;
+            for (size_t i = 0; i < rounds; ++i) {
+                acc += std::accumulate(vec.begin(), vec.end(), 0.0);
+            }
+            sink = sink + static_cast<size_t>(acc);
+        }));
+
+        report("1M Deque<double>, std::accumulate", measure_ms([&] {
+            double acc = 0;
+            for (size_t i = 0; i < rounds; ++i) {
+                acc += std::accumulate(d.begin(), d.end(), 0.0);
+            }
+            sink = sink + static_cast<size_t>(acc);
+        }));
+
+        report("1M Deque<double>, segmented::accumulate", measure_ms([&] {
+            double acc = 0;
+            for (size_t i = 0; i < rounds; ++i) {
+                acc += segmented::accumulate(d.begin(), d.end(), 0.0);
+            }
+            sink = sink + static_cast<size_t>(acc);
+        }));
+    }
+
+    void bench_scans(size_t size, size_t rounds) {
+        Deque<float> d;
+        std::mt19937 gen(3);
+        for (size_t i = 0; i < size; ++i) {
+            d.push_back(static_cast<float>(gen() % 1000));
+        }
+
+        auto run = [&](const std::string& name, auto scan) {
+            report("1M Deque<float>, " + name, measure_ms([&] {
+                ptrdiff_t acc = 0;
+                for (size_t i = 0; i < rounds; ++i) {
+                    acc += scan();
+                }
+                sink = sink + static_cast<size_t>(acc);
+            }));
+        };
+        run("std::count", [&] { return std::count(d.begin(), d.end(), 5.0F); });
+        run("segmented::count", [&] { return segmented::count(d.begin(), d.end(), 5.0F); });
+        run("simd::count", [&] { return simd::count(d.begin(), d.end(), 5.0F); });
+        run("std::min_element", [&] { return std::min_element(d.begin(), d.end()) - d.begin(); });
+        run("simd::min_element", [&] { return simd::min_element(d.begin(), d.end()) - d.begin(); });
+    }
+
+    void bench_parallel(size_t size) {
+        Deque<int> d;
+        std::mt19937 gen(11);
+        for (size_t i = 0; i < size; ++i) {
+            d.push_back(static_cast<int>(gen()));
+        }
+        auto copy = d;
+        std::cout << "parallel algorithms on " << ThreadPool::shared().size() << " thread(s)\n";
+
+        report("4M Deque<int>, std::sort", measure_ms([&] {
+            std::sort(d.begin(), d.end());
+        }));
+        report("4M Deque<int>, parallel::sort", measure_ms([&] {
+            parallel::sort(copy.begin(), copy.end());
+        }));
+        report("4M Deque<int>, parallel::reduce", measure_ms([&] {
+            sink = sink + static_cast<size_t>(parallel::reduce(d.begin(), d.end(), int64_t(0)));
+        }));
+    }
+
+    void bench_reserved_ingest(size_t batches, size_t batch) {
+        report("1M-element batches, push_back", measure_ms([&] {
+            for (size_t i = 0; i < batches; ++i) {
+                Deque<int> d;
+                for (size_t j = 0; j < batch; ++j) {
+                    d.push_back(static_cast<int>(j));
+                }
+                sink = sink + d.size();
+            }
+        }));
+        report("1M-element batches, reserve_back + push_back", measure_ms([&] {
+            for (size_t i = 0; i < batches; ++i) {
+                Deque<int> d;
+                d.reserve_back(batch);
+                for (size_t j = 0; j < batch; ++j) {
+                    d.push_back(static_cast<int>(j));
+                }
+                sink = sink + d.size();
+            }
+        }));
+    }
+
+    void bench_resize(size_t size, size_t rounds) {
+        report("16M Deque<int>, resize", measure_ms([&] {
+            for (size_t i = 0; i < rounds; ++i) {
+                Deque<int> d;
+                d.resize(size);
+                sink = sink + d.size();
+            }
+        }));
+        report("16M Deque<int>, resize_for_overwrite", measure_ms([&] {
+            for (size_t i = 0; i < rounds; ++i) {
+                Deque<int> d;
+                d.resize_for_overwrite(size);
+                sink = sink + d.size();
+            }
+        }));
+    }
+
+    void bench_bulk_copy(size_t size) {
+        const std::vector<int> vec(size, 1);
+        const Deque<int> d(size, 1);
+        report("10M std::vector<int> copy", measure_ms([&] {
+            std::vector<int> copy(vec);
+            sink = sink + copy.size();
+        }));
+        report("10M Deque<int> copy", measure_ms([&] {
+            Deque<int> copy(d);
+            sink = sink + copy.size();
+        }));
+        report("10M Deque<int> fill construction", measure_ms([&] {
+            Deque<int> filled(size, 7);
+            sink = sink + filled.size();
+        }));
+    }
+
+    void bench_empty_deques(size_t count) {
+        report("1M empty Deque<int> in a vector", measure_ms([&] {
+            std::vector<Deque<int>> sessions(count);
+            sink = sink + sessions.size();
+        }));
+    }
+
+    template<typename Queue>
+    void bench_short_queues(const std::string& name, size_t queues, size_t messages) {
+        report(name, measure_ms([&] {
+            for (size_t i = 0; i < queues; ++i) {
+                Queue queue;
+                for (size_t j = 0; j < messages; ++j) {
+                    queue.push_back(static_cast<int>(j));
+                    if (queue.size() > 4) {
+                        sink = sink + static_cast<size_t>(queue.front());
+                        queue.pop_front();
+                    }
+                }
+            }
+        }));
+    }
+
+    struct UnpooledChunks : DequePolicy {
+        static constexpr size_t pool_thread_chunks = 0;
+    };
+
+    template<typename Policy>
+    void bench_chunk_churn(const std::string& name, size_t deques, size_t elements) {
+        report(name, measure_ms([&] {
+            for (size_t i = 0; i < deques; ++i) {
+                Deque<int, std::allocator<int>, Policy> d;
+                for (size_t j = 0; j < elements; ++j) {
+                    d.push_back(static_cast<int>(j));
+                }
+                sink = sink + d.size();
+            }
+        }));
+    }
+
+    struct UnrecycledChunks : DequePolicy {
+        static constexpr bool recycle_chunks = false;
+    };
+
+    // cache line sized messages whose chunks come from a shared memory resource, where every
+    // allocation takes a lock
+    template<typename Policy>
+    void bench_steady_fifo(const std::string& name, size_t backlog, size_t messages) {
+        using Message = std::array<size_t, 8>;
+        std::pmr::synchronized_pool_resource resource;
+        pmr::Deque<Message, Policy> queue(backlog, Message{}, &resource);
+        report(name, measure_ms([&] {
+            for (size_t i = 0; i < messages; ++i) {
+                queue.push_back(Message{i});
+                sink = sink + queue.front()[0];
+                queue.pop_front();
+            }
+        }));
+    }
+
+    struct IncrementalMap : DequePolicy {
+        static constexpr bool incremental_map = true;
+    };
+
+    // every push_back of a growing deque timed on its own, the map of 64 byte messages
+    // reaches a few MB, which the default policy copies within a single push
+    template<typename Policy>
+    void bench_push_latency(const std::string& name, size_t count) {
+        using Message = std::array<size_t, 8>;
+        Deque<Message, std::allocator<Message>, Policy> d;
+        std::vector<int64_t> samples(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            d.push_back(Message{i});
+            auto finish = std::chrono::steady_clock::now();
+            samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+        }
+        sink = sink + d.size();
+        report_latency(name, samples);
+    }
+
+    // every push_back + pop_front of a steady queue of 64 byte messages timed on its own, after a
+    // warm-up that brings the map into shape; rearrangements of the map show up in the tail
+    template<typename Policy>
+    void bench_fifo_latency(const std::string& name, size_t backlog, size_t count) {
+        using Message = std::array<size_t, 8>;
+        Deque<Message, std::allocator<Message>, Policy> queue(backlog);
+        for (size_t i = 0; i < 2 * backlog; ++i) {
+            queue.push_back(Message{i});
+            queue.pop_front();
+        }
+        std::vector<int64_t> samples(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            queue.push_back(Message{i});
+            queue.pop_front();
+            auto finish = std::chrono::steady_clock::now();
+            samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+        }
+        sink = sink + queue.front()[0];
+        // the percentiles do not reach a few slow operations per million, count them
+        auto slow = std::count_if(samples.begin(), samples.end(), [](int64_t sample) { return sample > 1'000'000; });
+        report_latency(name, samples);
+        std::cout << std::left << std::setw(48) << (name + ", ops over 1 ms") << std::right << std::setw(10) << slow << "\n";
+    }
+
+    // 64 byte messages, eight to a chunk, so that the map is a noticeable part of the work
+    template<typename Policy>
+    void bench_map_growth(const std::string& name, size_t count) {
+        using Message = std::array<size_t, 8>;
+        using Queue = Deque<Message, std::allocator<Message>, Policy>;
+        report(name + ", push_back log", measure_ms([&] {
+            Queue log;
+            for (size_t i = 0; i < count; ++i) {
+                log.push_back(Message{i});
+            }
+            sink = sink + log.size();
+        }));
+        report(name + ", push_front stack", measure_ms([&] {
+            Queue stack;
+            for (size_t i = 0; i < count; ++i) {
+                stack.push_front(Message{i});
+            }
+            sink = sink + stack.size();
+        }));
+        report(name + ", FIFO of 100k", measure_ms([&] {
+            Queue fifo(100'000);
+            for (size_t i = 0; i < count; ++i) {
+                fifo.push_back(Message{i});
+                sink = sink + fifo.front()[0];
+                fifo.pop_front();
+            }
+        }));
+    }
+
+    struct MappedChunkPolicy : DequePolicy {
+        static constexpr bool mapped_chunks = true;
+    };
+
+    struct ColdMappedChunkPolicy : MappedChunkPolicy {
+        static constexpr size_t mapped_warm_regions = 0;
+    };
+
+    // counts the data TLB misses of this thread in user space, -1 where perf events are not available
+    class TlbMisses {
+    public:
+        TlbMisses() {
+#if __has_include(<linux/perf_event.h>)
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        ~TlbMisses() {
+#if __has_include(<linux/perf_event.h>)
+            if (fd >= 0) {
+                close(fd);
+            }
+#endif
+        }
+
+        TlbMisses(const TlbMisses&) = delete;
+        TlbMisses& operator=(const TlbMisses&) = delete;
+
+        long long read() const {
+#if __has_include(<linux/perf_event.h>)
+            long long count = 0;
+            if (fd >= 0 && ::read(fd, &count, sizeof(count)) == sizeof(count)) {
+                return count;
+            }
+#endif
+            return -1;
+        }
+
+    private:
+        int fd = -1;
+    };
+
+    template<typename Policy>
+    void bench_huge_deque(const std::string& name, size_t count, size_t reads) {
+        Deque<uint8_t, std::allocator<uint8_t>, Policy> d;
+        report(name + ", push_back", measure_ms([&] {
+            for (size_t i = 0; i < count; ++i) {
+                d.push_back(static_cast<uint8_t>(i));
+            }
+        }));
+
+        long long misses = -1;
+        report(name + ", random operator[]", measure_ms([&] {
+            TlbMisses counter;
+            size_t acc = 0;
+            uint64_t state = 42;
+            for (size_t i = 0; i < reads; ++i) {
+                // a 64-bit LCG, its high bits scaled to the size
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                acc += d[((state >> 32) * count) >> 32];
+            }
+            misses = counter.read();
+            sink = sink + acc;
+        }));
+        std::cout << std::left << std::setw(48) << (name + ", dTLB load misses") << std::right << std::setw(10);
+        if (misses >= 0) {
+            std::cout << misses << "\n";
+        } else {
+            std::cout << "n/a\n";
+        }
+    }
+
+    // batches that fill a deque and give all of its chunks back, without warm regions every
+    // batch faults the pages of its region in again
+    template<typename Policy>
+    void bench_drain_refill(const std::string& name, size_t count, size_t batches) {
+        report(name, measure_ms([&] {
+            for (size_t batch = 0; batch < batches; ++batch) {
+                Deque<uint8_t, std::allocator<uint8_t>, Policy> d(count, uint8_t(1));
+                sink = sink + d[count / 2];
+            }
+        }));
+    }
+}
+int main() {
+    const size_t small_count = 1 << 24;
+    const size_t large_count = 1 << 14;
+
+    bench_chunk_policy<char, LegacyChunks<char>>("char, 32 elements/chunk", small_count);
+    bench_chunk_policy<char, DequePolicy>("char, default policy", small_count);
+    bench_chunk_policy<Payload, LegacyChunks<Payload>>("4 KB payload, 32 elements/chunk", large_count);
+    bench_chunk_policy<Payload, DequePolicy>("4 KB payload, default policy", large_count);
+
+    bench_vector_of_deques(1 << 12, 1 << 12);
+    bench_bulk_append(1 << 6, 1 << 6, 1 << 12);
+
+    bench_middle_edits<BoxedInt>("100k Deque<BoxedInt>,", 100'000, 1'000);
+    bench_middle_edits<int>("100k Deque<int>,", 100'000, 1'000);
+    bench_batch_erase(100'000, 10'000);
+    bench_filter(100'000);
+    bench_accumulate(1'000'000, 100);
+    bench_scans(1'000'000, 100);
+    bench_parallel(1 << 22);
+    bench_chunk_churn<UnpooledChunks>("100k short-lived Deque<int>, global allocator", 100'000, 1'000);
+    bench_chunk_churn<DequePolicy>("100k short-lived Deque<int>, chunk pool", 100'000, 1'000);
+    bench_reserved_ingest(20, 1 << 20);
+    bench_resize(1 << 24, 5);
+    bench_bulk_copy(10'000'000);
+    bench_empty_deques(1'000'000);
+    bench_short_queues<Deque<int>>("1M short work queues, Deque<int>", 1'000'000, 16);
+    bench_short_queues<SmallDeque<int, 8>>("1M short work queues, SmallDeque<int, 8>", 1'000'000, 16);
+    bench_short_queues<StaticDeque<int, 8>>("1M short work queues, StaticDeque<int, 8>", 1'000'000, 16);
+    bench_steady_fifo<UnrecycledChunks>("20M FIFO messages, pmr pool, freed chunks", 10'000, 20'000'000);
+    bench_steady_fifo<DequePolicy>("20M FIFO messages, pmr pool, recycled chunks", 10'000, 20'000'000);
+    bench_push_latency<DequePolicy>("16M push_back latency, amortized map", 1 << 24);
+    bench_push_latency<IncrementalMap>("16M push_back latency, incremental map", 1 << 24);
+    bench_fifo_latency<DequePolicy>("16M FIFO op latency, 1M queue, default", 1 << 20, 1 << 24);
+    bench_fifo_latency<QueuePolicy>("16M FIFO op latency, 1M queue, QueuePolicy", 1 << 20, 1 << 24);
+    bench_map_growth<DequePolicy>("4M, balanced map", 1 << 22);
+    bench_map_growth<BackGrowthPolicy>("4M, back growth map", 1 << 22);
+    bench_map_growth<FrontGrowthPolicy>("4M, front growth map", 1 << 22);
+    bench_huge_deque<DequePolicy>("1G Deque<uint8_t>, heap chunks", 1 << 30, 1 << 26);
+    bench_huge_deque<MappedChunkPolicy>("1G Deque<uint8_t>, mapped chunks", 1 << 30, 1 << 26);
+    bench_drain_refill<ColdMappedChunkPolicy>("64 refills of 16M, mapped, no warm region", 1 << 24, 64);
+    bench_drain_refill<MappedChunkPolicy>("64 refills of 16M, mapped, one warm region", 1 << 24, 64);
+
+    return 0;
+}
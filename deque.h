@@ -1,511 +1,4170 @@
 #ifndef PROJECT_DEQUE_H
 #define PROJECT_DEQUE_H
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
 #include <iterator>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-namespace {
-    const size_t chunk_size = 1 << 5;
-    const ptrdiff_t ptr_chunk_size = 1 << 5;
-}
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#endif
 
-template <typename T>
-struct BaseDeque {
-    struct ChunkArray {
-    private:
-        ChunkArray(size_t elems_count, size_t chunks_count) :  begin(new T*[chunks_count + 1]),
-                                                               end(begin + chunks_count),
-                                                               cur_begin(begin),
-                                                               cur_end(begin + elems_count / chunk_size) {}
+// Compile-time tuning knobs of Deque. Derive from it and override
+// the fields you need, e.g. struct BigChunks : DequePolicy { static constexpr size_t chunk_bytes = 4096; };
+struct DequePolicy {
+    // Byte budget of a single chunk. The number of elements per chunk is
+    // the largest power of two that fits into it (at least one element).
+    static constexpr size_t chunk_bytes = 512;
 
-    public:
-        T** begin;
-        T** end;
-        T** cur_begin;
-        T** cur_end;
+    // Chunks of deques with std::allocator are recycled through ChunkPool: every thread keeps
+    // up to pool_thread_chunks free chunks of a size and a shared reserve up to pool_shared_chunks.
+    // Chunks larger than pool_max_chunk_bytes bypass the pool, pool_thread_chunks = 0 disables it.
+    static constexpr size_t pool_thread_chunks = 64;
+    static constexpr size_t pool_shared_chunks = 1024;
+    static constexpr size_t pool_max_chunk_bytes = size_t(1) << 16;
 
-        ChunkArray(const ChunkArray&) = delete;
-        ChunkArray& operator=(ChunkArray) = delete;
+    // Memory reclamation after pops: a deque keeps at most spare_chunks empty chunks past each end
+    // of its elements and frees the ones that drain further away (SIZE_MAX keeps all of them).
+    // With map_shrink_ratio > 0, pops and erases also reallocate the map to map_growth_factor times
+    // its used part once that is less than 1/map_shrink_ratio of it. Unlike std::deque this
+    // invalidates all iterators on pops, so it is opt-in; otherwise only shrink_to_fit shrinks the map.
+    static constexpr size_t spare_chunks = 2;
+    static constexpr size_t map_shrink_ratio = 0;
 
-        explicit ChunkArray(size_t elems_count) : ChunkArray(elems_count, (elems_count + chunk_size - 1) / chunk_size) {
-            size_t sz = (elems_count + chunk_size - 1) / chunk_size;
-            size_t ind = 0;
-            try {
-                for (; ind < sz; ++ind) {
-                    begin[ind] = reinterpret_cast<T*>(new int8_t[chunk_size * sizeof(T)]);
-                }
-                ++ind;
-                *end = reinterpret_cast<T*>(new int8_t[sizeof(T)]);
-            } catch (...) {
-                for (size_t j = 0; j < ind; ++j) {
-                    delete[] reinterpret_cast<int8_t*>(begin[j]);
-                }
-                delete[] begin;
-                throw;
-            }
-        }
+    // A chunk that drains past the spare_chunks limit at one end is moved into a free spare slot
+    // at the other end instead of being freed, so a steady FIFO (or LIFO at the front) stops allocating.
+    // It still shifts its map now and then, see QueuePolicy for one that does not.
+    static constexpr bool recycle_chunks = true;
 
-        void swap(ChunkArray& tmp) {
-            std::swap(begin, tmp.begin);
-            std::swap(end, tmp.end);
-            std::swap(cur_begin, tmp.cur_begin);
-            std::swap(cur_end, tmp.cur_end);
+    // Map growth: once push_back (push_front) reaches an end of the map, the used slots of the map
+    // are moved within it if they take less than 1/map_shift_ratio of it (never if 0), otherwise
+    // into a map map_growth_factor times larger. map_front_percent of the free slots of the result
+    // go in front of the used ones and the rest behind them, except that the end that ran out gets
+    // at least a quarter of them, so that pushes there do not rearrange the map after every chunk.
+    static constexpr size_t map_growth_factor = 3;
+    static constexpr size_t map_shift_ratio = 3;
+    static constexpr size_t map_front_percent = 50;
+
+    // With incremental_map the map is not rearranged in one go once an end of it is reached: when
+    // a quarter of it is left at that end, the next map is allocated and the pushes copy a bounded
+    // number of slots each into it, so that no single push does more than a constant amount of work.
+    // It costs a branch per push and the memory of both maps during the migration.
+    static constexpr bool incremental_map = false;
+
+    // With mapped_chunks, deques with std::allocator take their chunks from MappedChunks instead of
+    // ChunkPool, and maps of huge_page_bytes and more get mappings of their own. Meant for very
+    // large deques, where transparent huge pages cut the TLB misses of random access. Up to
+    // mapped_warm_regions regions whose chunks are all free keep their pages, so that a deque that
+    // drains and refills does not fault its huge pages in again every time.
+    static constexpr bool mapped_chunks = false;
+    static constexpr size_t mapped_warm_regions = 1;
+};
+
+// Map growth presets. The balanced default splits the free slots of a grown map evenly. A deque that
+// only grows at the back (an append-only log, a FIFO) or only at the front never uses the slots on
+// the other side, these give all of them to the growing end and let the map grow twice instead.
+struct BackGrowthPolicy : DequePolicy {
+    static constexpr size_t map_growth_factor = 2;
+    static constexpr size_t map_shift_ratio = 2;
+    static constexpr size_t map_front_percent = 0;
+};
+
+struct FrontGrowthPolicy : DequePolicy {
+    static constexpr size_t map_growth_factor = 2;
+    static constexpr size_t map_shift_ratio = 2;
+    static constexpr size_t map_front_percent = 100;
+};
+
+// A steady queue (push_back + pop_front) walks through its map and, with the default policy,
+// shifts all of it within a single push whenever the elements reach its end. This one migrates
+// the map incrementally instead; once the queue has settled it alternates between two maps of the
+// same size while the drained chunks are recycled to the back, so no push or pop allocates or does
+// more than a constant amount of work.
+struct QueuePolicy : DequePolicy {
+    static constexpr bool incremental_map = true;
+};
+
+// Policy of RealtimeDeque: the map is never shrunk, so pops do not reallocate it and its arena
+// only needs room for the largest map pushes grow it to, see RealtimeArena::budget_for.
+struct RealtimePolicy : DequePolicy {
+    static constexpr size_t map_shrink_ratio = 0;
+};
+
+// Free chunks of Bytes bytes kept for reuse instead of going back to the global allocator.
+// Each thread has its own list of up to ThreadLimit chunks; when it overflows, half of it moves
+// to a shared reserve of up to SharedLimit chunks and whatever does not fit there is freed.
+// An empty thread list takes a batch from the reserve. Free chunks are linked through their memory.
+template <size_t Bytes, size_t Align, size_t ThreadLimit, size_t SharedLimit>
+class ChunkPool {
+    static_assert(Bytes >= sizeof(void*) && Align >= alignof(void*) && ThreadLimit > 0);
+
+public:
+    static void* acquire() {
+        if (closed) {
+            return acquire_shared();
+        }
+        auto& local = local_list();
+        if (local.empty()) {
+            refill(local);
         }
+        return local.empty() ? ::operator new(Bytes, std::align_val_t(Align)) : local.pop();
+    }
 
-        void shift() {
-            //NOLINTNEXTLINE(readability-magic-numbers)
-            T** new_begin = begin + (end - begin) / 3;
-            T** it = new_begin;
-            for (; cur_begin < cur_end; ++it) {
-                std::swap(*cur_begin, *it);
-                ++cur_begin;
-            }
-            if (cur_end != end) {
-                std::swap(*cur_end, *it);
-            }
-            cur_begin = new_begin;
-            cur_end = it;
+    static void release(void* chunk) {
+        if (closed) {
+            FreeList single;
+            single.push(chunk);
+            spill(single, 1);
+            return;
+        }
+        auto& local = local_list();
+        if (local.size == ThreadLimit) {
+            spill(local, (ThreadLimit + 1) / 2);
         }
+        local.push(chunk);
+    }
 
-        void reallocate() {
-            size_t old_size = static_cast<size_t>(end - begin) + 1;
-            //NOLINTNEXTLINE(readability-magic-numbers)
-            T** new_arr = new T*[3 * old_size + 1]{};
-            std::copy(begin, end, new_arr + old_size);
-            //NOLINTNEXTLINE(readability-magic-numbers)
-            new_arr[3 * old_size] = *end;
-            delete[] begin;
+    // number of chunks in the shared reserve
+    static size_t reserved() {
+        auto& reserve = shared();
+        std::lock_guard lock(reserve.mutex);
+        return reserve.list.size;
+    }
 
-            auto diff = cur_end - cur_begin;
-            cur_begin = new_arr + old_size + (cur_begin - begin);
-            cur_end = cur_begin + diff;
+private:
+    struct Node {
+        Node* next;
+    };
 
-            begin = new_arr;
-            //NOLINTNEXTLINE(readability-magic-numbers)
-            end = begin + 3 * old_size;
+    struct FreeList {
+        Node* head = nullptr;
+        size_t size = 0;
+
+        bool empty() const {
+            return head == nullptr;
         }
 
-        void update() {
-            //NOLINTNEXTLINE(readability-magic-numbers)
-            if (3 * (cur_end - cur_begin + 1) < end - begin + 1) {
-                shift();
-            } else {
-                reallocate();
-            }
+        void push(void* chunk) {
+            head = ::new (chunk) Node{head};
+            ++size;
         }
 
-        ~ChunkArray() {
-            for (auto it = begin; it <= end; ++it) {
-                delete[] reinterpret_cast<int8_t*>(*it);
-            }
-            delete[] begin;
+        void* pop() {
+            Node* node = head;
+            head = node->next;
+            --size;
+            return node;
         }
     };
 
-    ChunkArray arr;
-    size_t m_size;
-    T* m_begin;
-    T* m_end;
+    // gives the chunks of an exiting thread back
+    struct LocalList : FreeList {
+        LocalList() = default;
+        LocalList(const LocalList&) = delete;
+        LocalList& operator=(const LocalList&) = delete;
 
-    explicit BaseDeque(size_t n) : arr(n),
-                                   m_size(n),
-                                   m_begin(*arr.cur_begin),
-                                   m_end(arr.cur_begin[n / chunk_size] + n % chunk_size) {}
-};
+        ~LocalList() {
+            closed = true;
+            spill(*this, this->size);
+        }
+    };
 
-template <typename T>
-class Deque : BaseDeque<T> {
-public:
-    using value_type = T;
+    struct Shared {
+        std::mutex mutex;
+        FreeList list;
+    };
 
-private:
-    using BaseDeque<T>::arr;
-    using BaseDeque<T>::m_begin;
-    using BaseDeque<T>::m_end;
-    using BaseDeque<T>::m_size;
+    // set once the thread list is destroyed, chunks released after that go straight to the reserve
+    inline static thread_local bool closed = false;
 
-    void next_end() {
-        ++m_end;
-        ++m_size;
-        if (m_end == *arr.cur_end + chunk_size) {
-            ++arr.cur_end;
-            if (!*(arr.cur_end)) {
-                *(arr.cur_end) = reinterpret_cast<T*>(new int8_t[chunk_size * sizeof(T)]);
-            }
-            m_end = *arr.cur_end;
-        }
+    static LocalList& local_list() {
+        thread_local LocalList list;
+        return list;
     }
 
-    void update() {
-        arr.update();
-        if (m_end == *arr.end) {
-            if (!*arr.cur_end) {
-                *arr.cur_end = reinterpret_cast<T*>(new int8_t[chunk_size * sizeof(T)]);
-            }
-            m_end = *arr.cur_end;
-            if (m_begin == *arr.end) {
-                m_begin = *arr.cur_end;
+    // never destroyed, deques with static storage duration may release chunks during exit
+    static Shared& shared() {
+        static auto* reserve = new Shared;
+        return *reserve;
+    }
+
+    static void spill(FreeList& from, size_t count) {
+        auto& reserve = shared();
+        std::lock_guard lock(reserve.mutex);
+        for (; count > 0; --count) {
+            void* chunk = from.pop();
+            if (reserve.list.size < SharedLimit) {
+                reserve.list.push(chunk);
+            } else {
+                ::operator delete(chunk, Bytes, std::align_val_t(Align));
             }
         }
     }
 
-public:
-    Deque() : BaseDeque<T>(0) {}
+    static void refill(FreeList& to) {
+        auto& reserve = shared();
+        std::lock_guard lock(reserve.mutex);
+        for (size_t count = (ThreadLimit + 1) / 2; count > 0 && !reserve.list.empty(); --count) {
+            to.push(reserve.list.pop());
+        }
+    }
 
-    explicit Deque(size_t n) : BaseDeque<T>(n) {
-        static_assert(std::is_default_constructible<T>::value);
-        auto it = begin();
-        try {
-            for (it = begin(); it != end(); ++it) {
-                new(&*it) T();
-            }
-        } catch (...) {
-            for (--it; it >= begin(); --it) {
-                it->~T();
+    static void* acquire_shared() {
+        {
+            auto& reserve = shared();
+            std::lock_guard lock(reserve.mutex);
+            if (!reserve.list.empty()) {
+                return reserve.list.pop();
             }
-            throw;
         }
+        return ::operator new(Bytes, std::align_val_t(Align));
     }
+};
 
-    Deque(const Deque& copy) : BaseDeque<T>(copy.size()) {
-        std::uninitialized_copy(copy.begin(), copy.end(), begin());
-    }
+// Anonymous memory mappings aligned to their size (a power of two), for MappedChunks and the
+// large maps of its deques. They are marked for transparent huge pages where the kernel offers
+// them; without mmap they come from the global allocator.
+namespace mapped {
+    inline constexpr size_t huge_page_bytes = size_t(1) << 21;
 
-    Deque(size_t n, const T& val) : BaseDeque<T>(n) {
-        std::uninitialized_fill(begin(), end(), val);
+    // `alignment` is a power of two of at least a page, `bytes` is rounded up to a multiple of it
+    inline void* map(size_t bytes, size_t alignment) {
+        bytes = (bytes + alignment - 1) & ~(alignment - 1);
+#if __has_include(<sys/mman.h>)
+        // map more and cut off what sticks out of the aligned range
+        size_t total = bytes + alignment;
+        void* raw = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        auto first = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (first + alignment - 1) & ~(alignment - 1);
+        if (aligned > first) {
+            ::munmap(raw, aligned - first);
+        }
+        if (first + total > aligned + bytes) {
+            ::munmap(reinterpret_cast<void*>(aligned + bytes), first + total - aligned - bytes);
+        }
+        auto* ptr = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+        // fails harmlessly where transparent huge pages are not available
+        ::madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+        return ptr;
+#else
+        return ::operator new(bytes, std::align_val_t(alignment));
+#endif
     }
 
-    void swap(Deque& tmp) {
-        arr.swap(tmp.arr);
-        std::swap(m_begin, tmp.m_begin);
-        std::swap(m_end, tmp.m_end);
-        std::swap(m_size, tmp.m_size);
+    inline void unmap(void* ptr, size_t bytes, size_t alignment) {
+        bytes = (bytes + alignment - 1) & ~(alignment - 1);
+#if __has_include(<sys/mman.h>)
+        ::munmap(ptr, bytes);
+#else
+        ::operator delete(ptr, bytes, std::align_val_t(alignment));
+#endif
     }
 
-    Deque<T>& operator=(Deque<T> copy) {
-        swap(copy);
-        return *this;
+    // gives the pages back to the kernel while keeping the range mapped, they read as zeros afterwards
+    inline void discard([[maybe_unused]] void* ptr, [[maybe_unused]] size_t bytes) {
+#if __has_include(<sys/mman.h>)
+        ::madvise(ptr, bytes, MADV_DONTNEED);
+#endif
     }
+}
 
-    size_t size() const {
-        return m_size;
-    }
-    bool empty() const {
-        return m_size == 0;
-    }
+// Chunks of Bytes bytes carved out of mapped regions of region_bytes, for deques with
+// DequePolicy::mapped_chunks. Chunks that are allocated together lie next to each other in huge
+// pages instead of being spread over the heap, and no heap fragments are left behind. A chunk is
+// taken from the region that was last given one back (or carved from its untouched end), then from
+// a warm region, regions that are all free are taken last. Once every chunk of a region is free,
+// it stays warm with its pages if fewer than WarmLimit regions are, otherwise its memory goes back
+// to the kernel with mapped::discard and the address range stays for later chunks. All threads
+// share the regions under a mutex.
+template <size_t Bytes, size_t Align, size_t WarmLimit>
+class MappedChunks {
+    static_assert(Align >= alignof(void*) && std::has_single_bit(Align));
 
-    void push_front(const T& val) {
-        if (m_begin != *arr.cur_begin) {
-            auto ptr = m_begin - 1;
-            new(ptr) T(val);
-            --m_begin;
-            ++m_size;
-            return;
-        }
+public:
+    static constexpr size_t region_bytes = std::max(size_t(1) << 25, std::bit_ceil(Bytes));
 
-        if (arr.cur_begin == arr.begin) {
-            update();
+    static void* acquire() {
+        auto& state = shared();
+        std::lock_guard lock(state.mutex);
+        auto& open = state.open;
+        while (!open.empty() && !open.back()->free && open.back()->carved == per_region) {
+            open.back()->listed = false;
+            open.pop_back();
         }
-
-        if (!*(arr.cur_begin - 1)) {
-            *(arr.cur_begin - 1) = reinterpret_cast<T*>(new int8_t[chunk_size * sizeof(T)]);
+        if (open.empty()) {
+            auto* base = static_cast<char*>(mapped::map(region_bytes, region_bytes));
+            Region& region = state.regions[reinterpret_cast<uintptr_t>(base)];
+            region.base = base;
+            region.listed = true;
+            open.push_back(&region);
         }
-
-        new(*(arr.cur_begin - 1) + chunk_size - 1) T(val);
-        --arr.cur_begin;
-        m_begin = *arr.cur_begin + chunk_size - 1;
-        ++m_size;
+        if (open.back()->used == 0 && !state.warm.empty() && open.back() != state.warm.back()) {
+            // a warm region is listed somewhere in the middle, its pages are still there
+            std::swap(*std::find(open.begin(), open.end(), state.warm.back()), open.back());
+        }
+        Region& region = *open.back();
+        if (region.used == 0 && !state.warm.empty() && &region == state.warm.back()) {
+            state.warm.pop_back();
+        }
+        ++region.used;
+        if (region.free) {
+            return std::exchange(region.free, region.free->next);
+        }
+        return region.base + stride * region.carved++;
     }
 
-    void push_back(const T& val) {
-        if (arr.cur_end == arr.end) {
-            update();
+    static void release(void* chunk) {
+        auto& state = shared();
+        std::lock_guard lock(state.mutex);
+        Region& region = state.regions.find(reinterpret_cast<uintptr_t>(chunk) & ~(region_bytes - 1))->second;
+        region.free = ::new (chunk) Node{region.free};
+        if (--region.used == 0) {
+            if (state.warm.size() < WarmLimit) {
+                state.warm.push_back(&region);
+            } else {
+                mapped::discard(region.base, region_bytes);
+                region.free = nullptr;
+                region.carved = 0;
+            }
+        }
+        if (!region.listed) {
+            region.listed = true;
+            auto& open = state.open;
+            open.insert(region.used == 0 ? open.begin() : open.end(), &region);
         }
-
-        new(m_end) T(val);
-        next_end();
     }
 
-    void pop_front() {
-        m_begin->~T();
-        ++m_begin;
-        --m_size;
-        if (m_begin == *arr.cur_begin + chunk_size) {
-            ++arr.cur_begin;
-            m_begin = *arr.cur_begin;
-        }
+    // number of regions mapped and chunks handed out
+    static size_t regions() {
+        auto& state = shared();
+        std::lock_guard lock(state.mutex);
+        return state.regions.size();
     }
 
-    void pop_back() {
-        if (m_end == *arr.cur_end) {
-            --arr.cur_end;
-            m_end = *arr.cur_end + chunk_size;
+    static size_t live() {
+        auto& state = shared();
+        std::lock_guard lock(state.mutex);
+        size_t count = 0;
+        for (auto& [base, region] : state.regions) {
+            count += region.used;
         }
-        --m_end;
-        --m_size;
-        m_end->~T();
+        return count;
     }
 
-    T& operator[](size_t ind) {
-        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
-        return arr.cur_begin[ind / chunk_size][ind % chunk_size];
-    }
+private:
+    static constexpr size_t stride = (std::max(Bytes, sizeof(void*)) + Align - 1) / Align * Align;
+    static constexpr size_t per_region = region_bytes / stride;
 
-    const T& operator[](size_t ind) const {
-        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
-        return arr.cur_begin[ind / chunk_size][ind % chunk_size];
-    }
+    struct Node {
+        Node* next;
+    };
 
-    T& at(size_t ind) {
-        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
-        auto it = arr.cur_begin + ind / chunk_size;
-        if (it < arr.end - 1 || (it == arr.end - 1 && *it + ind % chunk_size < m_end)) {
-            return arr.cur_begin[ind / chunk_size][ind % chunk_size];
-        }
-        throw std::out_of_range("Deque index out of range");
-    }
+    struct Region {
+        char* base = nullptr;
+        Node* free = nullptr;
+        size_t carved = 0;
+        size_t used = 0;
+        bool listed = false;
+    };
 
-    const T& at(size_t ind) const {
-        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
-        auto it = arr.cur_begin + ind / chunk_size;
-        if (it < arr.end - 1 || (it == arr.end - 1 && *it + ind % chunk_size < m_end)) {
-            return arr.cur_begin[ind / chunk_size][ind % chunk_size];
-        }
-        throw std::out_of_range("Deque index out of range");
-    }
+    struct Shared {
+        std::mutex mutex;
+        std::unordered_map<uintptr_t, Region> regions;
+        // regions with free chunks, the ones that are all free in front
+        std::vector<Region*> open;
+        // regions that are all free and keep their pages
+        std::vector<Region*> warm;
+    };
 
-    T& front() {
-        return *m_begin;
+    // never destroyed, deques with static storage duration may release chunks during exit
+    static Shared& shared() {
+        static auto* state = new Shared;
+        return *state;
     }
+};
 
-    const T& front() const {
-        return *m_begin;
-    }
+// Elements of such types may be moved around in memory with memmove instead of
+// move construction + destruction. Specialize it for your own relocatable types.
+template <typename T>
+struct TriviallyRelocatable : std::is_trivially_copyable<T> {};
 
-    T& back() {
-        return *rbegin();
-    }
+template <typename T, typename Allocator = std::allocator<T>, typename Policy = DequePolicy>
+struct BaseDeque {
+    using alloc_traits = std::allocator_traits<Allocator>;
+    using map_allocator = typename alloc_traits::template rebind_alloc<T*>;
+    using map_traits = std::allocator_traits<map_allocator>;
 
-    const T& back() const {
-        return *crbegin();
-    }
+    static_assert(std::is_same_v<typename alloc_traits::value_type, T>, "Allocator::value_type must be T");
+    static_assert(std::is_same_v<typename alloc_traits::pointer, T*>, "fancy pointers are not supported");
+    static_assert(Policy::map_growth_factor >= 2 && Policy::map_shift_ratio != 1 && Policy::map_front_percent <= 100,
+                  "the map growth policy has to leave room for the next push at both ends");
 
+    static constexpr size_t chunk_size = std::bit_floor(std::max<size_t>(Policy::chunk_bytes / sizeof(T), 1));
+    static constexpr ptrdiff_t ptr_chunk_size = static_cast<ptrdiff_t>(chunk_size);
 
-    template <typename Value>
-    struct BaseIterator {
-    public:
-        using difference_type = ptrdiff_t;
-        using value_type = Value;
-        using pointer = value_type*;
-        using reference = value_type&;
-        using const_reference = const value_type&;
-        using iterator_category = std::random_access_iterator_tag;
+    static constexpr size_t chunk_bytes = chunk_size * sizeof(T);
+    static constexpr bool mapped_chunks = Policy::mapped_chunks && std::is_same_v<Allocator, std::allocator<T>>;
+    static constexpr bool pooled_chunks = !mapped_chunks && Policy::pool_thread_chunks > 0 &&
+                                          std::is_same_v<Allocator, std::allocator<T>> &&
+                                          chunk_bytes >= sizeof(void*) &&
+                                          chunk_bytes <= Policy::pool_max_chunk_bytes;
+    using Pool = ChunkPool<chunk_bytes, std::max(alignof(T), alignof(std::max_align_t)),
+                           std::max<size_t>(Policy::pool_thread_chunks, 1), Policy::pool_shared_chunks>;
+    using Mapped = MappedChunks<chunk_bytes, std::max(alignof(T), alignof(std::max_align_t)), Policy::mapped_warm_regions>;
 
+    // Map of an empty deque: a single null end slot shared by all instances.
+    // It is never written to, so empty and moved-from deques own no memory.
+    static T** empty_map() noexcept {
+        static T* slot = nullptr;
+        return &slot;
+    }
+
+    struct ChunkArray {
     private:
-        pointer item;
-        T** cur_arr;
+        ChunkArray(size_t elems_count, size_t chunks_count, const Allocator& alloc) : alloc(alloc),
+                                                                                      begin(chunks_count > 0 ? allocate_map(chunks_count + 1) : empty_map()),
+                                                                                      end(begin + chunks_count),
+                                                                                      cur_begin(begin),
+                                                                                      cur_end(begin + elems_count / chunk_size) {}
 
-        T** first;
-        T** last;
+        // An incremental rearrangement of the map (Policy::incremental_map) in progress: the slots
+        // [keep_begin, keep_end) are copied into `next`, slot p to next[p - begin + delta], the
+        // chunks outside them are freed and the rest of `next` is nulled, `step` units per push.
+        // The map given up by the last migration is kept as `retired` for the next one of the same
+        // size, so a steady queue that keeps migrating between two maps does not allocate.
+        struct Migration {
+            T** next = nullptr;
+            size_t slots = 0;
+            ptrdiff_t delta = 0;
+            T** keep_begin = nullptr;
+            T** keep_end = nullptr;
+            size_t done = 0;
+            size_t total = 0;
+            size_t step = 0;
+            T** retired = nullptr;
+            size_t retired_slots = 0;
+        };
+        struct NoMigration {};
 
     public:
-        BaseIterator(pointer item, T** cur_arr, T** first, T** last) : item(item),
-                                                                       cur_arr(cur_arr),
-                                                                       first(first),
-                                                                       last(last) {}
+        Allocator alloc;
+        T** begin;
+        T** end;
+        T** cur_begin;
+        T** cur_end;
+        [[no_unique_address]] std::conditional_t<Policy::incremental_map, Migration, NoMigration> migration;
 
-        operator BaseIterator<const Value>() const {
-            return BaseIterator<const Value>(item, cur_arr, first, last);
-        }
+        ChunkArray(const ChunkArray&) = delete;
+        ChunkArray& operator=(ChunkArray) = delete;
 
-        reference operator*() const {
-            return *item;
+        explicit ChunkArray(const Allocator& alloc) noexcept : alloc(alloc),
+                                                               begin(empty_map()),
+                                                               end(begin),
+                                                               cur_begin(begin),
+                                                               cur_end(begin) {}
+
+        ChunkArray(ChunkArray&& other) noexcept : alloc(other.alloc),
+                                                  begin(std::exchange(other.begin, empty_map())),
+                                                  end(std::exchange(other.end, empty_map())),
+                                                  cur_begin(std::exchange(other.cur_begin, empty_map())),
+                                                  cur_end(std::exchange(other.cur_end, empty_map())),
+                                                  migration(std::exchange(other.migration, {})) {}
+
+        ChunkArray(size_t elems_count, const Allocator& alloc) : ChunkArray(elems_count, (elems_count + chunk_size - 1) / chunk_size, alloc) {
+            if (!owns_map()) {
+                return;
+            }
+            // the delegated constructor has completed, so ~ChunkArray cleans up if an allocation throws
+            std::fill(begin, end + 1, nullptr);
+            for (T** it = begin; it < end; ++it) {
+                *it = allocate_chunk();
+            }
         }
 
-        pointer operator->() const {
-            return item;
+        bool owns_map() const {
+            return begin != empty_map();
         }
 
-        BaseIterator& operator++() {
-            ++item;
-            if (cur_arr < last && item == *cur_arr + ptr_chunk_size) {
-                ++cur_arr;
-                item = *cur_arr;
+        T* allocate_chunk() {
+            if constexpr (mapped_chunks) {
+                return static_cast<T*>(Mapped::acquire());
+            } else if constexpr (pooled_chunks) {
+                return static_cast<T*>(Pool::acquire());
+            } else {
+                return alloc_traits::allocate(alloc, chunk_size);
             }
-            return *this;
         }
 
-        BaseIterator operator++(int) {
-            auto copy = *this;
-            ++*this;
-            return copy;
+        void deallocate_chunk(T* chunk) {
+            if constexpr (mapped_chunks) {
+                Mapped::release(chunk);
+            } else if constexpr (pooled_chunks) {
+                Pool::release(chunk);
+            } else {
+                alloc_traits::deallocate(alloc, chunk, chunk_size);
+            }
         }
 
-        BaseIterator& operator--() {
-            if (cur_arr > first && item == *cur_arr) {
-                --cur_arr;
-                item = *cur_arr + ptr_chunk_size;
+        T** allocate_map(size_t count) {
+            if constexpr (mapped_chunks) {
+                if (count * sizeof(T*) >= mapped::huge_page_bytes) {
+                    return static_cast<T**>(mapped::map(count * sizeof(T*), mapped::huge_page_bytes));
+                }
             }
-            --item;
-            return *this;
+            map_allocator map_alloc(alloc);
+            return map_traits::allocate(map_alloc, count);
         }
 
-        BaseIterator operator--(int) {
-            auto copy = *this;
-            --*this;
-            return copy;
+        void deallocate_map(T** map, size_t count) {
+            if constexpr (mapped_chunks) {
+                if (count * sizeof(T*) >= mapped::huge_page_bytes) {
+                    mapped::unmap(map, count * sizeof(T*), mapped::huge_page_bytes);
+                    return;
+                }
+            }
+            map_allocator map_alloc(alloc);
+            map_traits::deallocate(map_alloc, map, count);
         }
 
-    private:
-        template <size_t N>
-        void sum(difference_type diff, T** border) {
-            diff += item - (*cur_arr + N);
-            cur_arr += diff / ptr_chunk_size;
-            if (first <= cur_arr && cur_arr <= last) {
-                item = (*cur_arr + N) + diff % ptr_chunk_size;
+        // whether allocate_chunk() (allocate_map(count)) stays within the budget of an allocator
+        // that reports it through can_allocate(n), see RealtimeAllocator; other ones are just asked
+        bool can_allocate_chunk() const {
+            if constexpr (requires { alloc.can_allocate(chunk_size); }) {
+                return alloc.can_allocate(chunk_size);
             } else {
-                item = *border + diff % ptr_chunk_size + (cur_arr - border) * ptr_chunk_size;
-                cur_arr = border;
+                return true;
             }
         }
 
-    public:
-        BaseIterator& operator+=(difference_type diff) {
-            if (diff >= 0) {
-                sum<0>(diff, last);
+        bool can_allocate_map(size_t count) const {
+            map_allocator map_alloc(alloc);
+            if constexpr (requires { map_alloc.can_allocate(count); }) {
+                return map_alloc.can_allocate(count);
             } else {
-                sum<chunk_size - 1>(diff, first);
+                return true;
             }
-            return *this;
         }
 
-        BaseIterator& operator-=(difference_type diff) {
-            return *this += -diff;
+        // whether update() either rearranges the map in place or finds room for the new one
+        bool can_update(bool at_front) const {
+            auto [slots, front] = next_layout(at_front);
+            return slots == static_cast<size_t>(end - begin) || can_allocate_map(slots + 1);
         }
 
-        BaseIterator operator+(difference_type diff) const {
-            BaseIterator copy = *this;
-            copy += diff;
-            return copy;
+        void swap(ChunkArray& tmp) {
+            std::swap(begin, tmp.begin);
+            std::swap(end, tmp.end);
+            std::swap(cur_begin, tmp.cur_begin);
+            std::swap(cur_end, tmp.cur_end);
+            std::swap(migration, tmp.migration);
         }
 
-        BaseIterator operator-(difference_type diff) const {
-            return *this + (-diff);
-        }
+        // stores a chunk (or null) into a slot, every slot of the map is written through it
+        void set(T** slot, T* chunk) {
+            *slot = chunk;
+            if constexpr (Policy::incremental_map) {
+                if (migration.next) {
+                    mirror(slot);
+                }
+            }
+        }
 
-        difference_type operator-(const BaseIterator& it) const {
-            return ptr_chunk_size * (cur_arr - it.cur_arr) + (item - *cur_arr) - (it.item - *it.cur_arr);
+        bool migrating() const {
+            if constexpr (Policy::incremental_map) {
+                return migration.next != nullptr;
+            } else {
+                return false;
+            }
         }
 
-        reference operator[](difference_type diff) {
-            return *(*this + diff);
+        // Starts moving into the map update() would choose now, to be finished within `calls`
+        // calls of migrate(). The slots that do not fit into it are left behind (after a shift).
+        void start_migration(size_t calls, bool at_front) {
+            auto& mig = migration;
+            auto size = end - begin;
+            auto [slots, front] = next_layout(at_front);
+            mig.slots = slots;
+            mig.delta = static_cast<ptrdiff_t>(front) - (cur_begin - begin);
+            if (mig.retired && mig.retired_slots == mig.slots) {
+                mig.next = std::exchange(mig.retired, nullptr);
+            } else {
+                drop_retired_map();
+                mig.next = allocate_map(mig.slots + 1);
+            }
+            mig.keep_begin = begin + std::max<ptrdiff_t>(0, -mig.delta);
+            mig.keep_end = begin + std::min(size + 1, static_cast<ptrdiff_t>(mig.slots) - mig.delta);
+            mig.done = 0;
+            mig.total = mig.slots + 1 + static_cast<size_t>((mig.keep_begin - begin) + std::max<ptrdiff_t>(0, end - mig.keep_end));
+            mig.step = (mig.total + calls - 1) / std::max<size_t>(calls, 1);
         }
-        const_reference operator[](difference_type diff) const {
-            return *(*this + diff);
+
+        // does `work` more units of the migration: a slot of the new map nulled or copied
+        // into, or a slot left behind freed
+        void migrate(size_t work) {
+            auto& mig = migration;
+            if (cur_begin < mig.keep_begin || cur_end >= mig.keep_end) {
+                // the elements moved where the new map has no room for them
+                cancel_migration();
+                return;
+            }
+            auto kept = static_cast<size_t>(mig.keep_end - mig.keep_begin);
+            T** image = mig.next + (mig.keep_begin - begin) + mig.delta;
+            auto front = static_cast<size_t>(image - mig.next);
+            size_t done = mig.done;
+            size_t target = std::min(mig.total, done + work);
+            size_t phase = 0;
+            auto run = [&](size_t length, auto action) {
+                size_t from = std::clamp(done, phase, phase + length) - phase;
+                size_t to = std::clamp(target, phase, phase + length) - phase;
+                if (from < to) {
+                    action(from, to);
+                }
+                phase += length;
+            };
+            run(front, [&](size_t from, size_t to) {
+                std::fill(mig.next + from, mig.next + to, nullptr);
+            });
+            run(mig.slots + 1 - front - kept, [&](size_t from, size_t to) {
+                std::fill(image + kept + from, image + kept + to, nullptr);
+            });
+            run(static_cast<size_t>(mig.keep_begin - begin), [&](size_t from, size_t to) {
+                release(begin + from, begin + to);
+            });
+            run(static_cast<size_t>(std::max<ptrdiff_t>(0, end - mig.keep_end)), [&](size_t from, size_t to) {
+                release(mig.keep_end + from, mig.keep_end + to);
+            });
+            run(kept, [&](size_t from, size_t to) {
+                std::copy(mig.keep_begin + from, mig.keep_begin + to, image + from);
+            });
+            mig.done = target;
         }
 
-        bool operator==(const BaseIterator& other) const {
-            return item == other.item;
+        void migrate() {
+            migrate(migration.step);
         }
-        bool operator!=(const BaseIterator& other) const {
-            return item != other.item;
+
+        // completes the migration and switches to the new map, false if there is none (any more)
+        bool finish_migration() {
+            auto& mig = migration;
+            if (!mig.next) {
+                return false;
+            }
+            migrate(mig.total);
+            if (!mig.next) {
+                return false;
+            }
+            drop_retired_map();
+            mig.retired = begin;
+            mig.retired_slots = static_cast<size_t>(end - begin);
+            cur_begin = mig.next + (cur_begin - begin) + mig.delta;
+            cur_end = mig.next + (cur_end - begin) + mig.delta;
+            begin = std::exchange(mig.next, nullptr);
+            end = begin + mig.slots;
+            return true;
         }
 
-        auto operator<=>(const BaseIterator& other) const {
-            return cur_arr == other.cur_arr ? item <=> other.item : cur_arr <=> other.cur_arr;
+        void cancel_migration() {
+            if constexpr (Policy::incremental_map) {
+                if (migration.next) {
+                    deallocate_map(std::exchange(migration.next, nullptr), migration.slots + 1);
+                }
+            }
+        }
+
+        void drop_retired_map() {
+            if constexpr (Policy::incremental_map) {
+                if (migration.retired) {
+                    deallocate_map(std::exchange(migration.retired, nullptr), migration.retired_slots + 1);
+                }
+            }
+        }
+
+        // keeps a slot written during the migration up to date in the new map
+        void mirror(T** slot) {
+            auto& mig = migration;
+            if (slot < mig.keep_begin || slot >= mig.keep_end) {
+                if (*slot) {
+                    // a chunk where the new map has no slot for it
+                    cancel_migration();
+                }
+                return;
+            }
+            auto kept = static_cast<size_t>(mig.keep_end - mig.keep_begin);
+            size_t copied = mig.done > mig.total - kept ? mig.done - (mig.total - kept) : 0;
+            if (slot < mig.keep_begin + copied) {
+                mig.next[(slot - begin) + mig.delta] = *slot;
+            }
+        }
+
+        //NOLINTNEXTLINE(readability-magic-numbers)
+        static constexpr size_t min_share_of_free = 4;
+
+        // The map update() moves the used slots [cur_begin, cur_end] into, as the number of its
+        // slots and the index of cur_begin in it, see the map growth fields of DequePolicy.
+        // The end that runs out (the front if at_front) gets at least 1/min_share_of_free of the
+        // free slots whatever the placement, or pushes there would rearrange the map again after
+        // every chunk.
+        std::pair<size_t, size_t> next_layout(bool at_front) const {
+            auto size = static_cast<size_t>(end - begin);
+            auto used = static_cast<size_t>(cur_end - cur_begin) + 1;
+            bool shift = Policy::map_shift_ratio > 0 && Policy::map_shift_ratio * used < size + 1;
+            size_t slots = shift ? size : Policy::map_growth_factor * (size + 1);
+            size_t free = slots - used;
+            //NOLINTNEXTLINE(readability-magic-numbers)
+            size_t front = free * Policy::map_front_percent / 100;
+            if (at_front) {
+                front = std::max(front, free / min_share_of_free);
+            } else {
+                front = std::min(front, free - free / min_share_of_free);
+            }
+            return {slots, std::clamp<size_t>(front, 1, free)};
+        }
+
+        // moves the used slots to index `front` of a map with `slots` slots, within the map if it
+        // keeps its size; the chunks outside the used slots that do not fit into it are freed
+        void relocate(size_t slots, size_t front) {
+            cancel_migration();
+            auto at = static_cast<size_t>(cur_begin - begin);
+            if (slots != static_cast<size_t>(end - begin)) {
+                T** first = begin + (at > front ? at - front : 0);
+                T** last = begin + std::min(static_cast<size_t>(end - begin), at + slots - front);
+                release(begin, first);
+                release(last, end);
+                move_map(first, last, slots, front - static_cast<size_t>(cur_begin - first));
+                return;
+            }
+            // the end slot stays null, the slots in the way of the used ones take their place
+            T** last = cur_end == end ? cur_end : cur_end + 1;
+            T** target = begin + front;
+            auto count = last - cur_begin;
+            if (target + count <= cur_begin || cur_begin + count <= target) {
+                std::swap_ranges(cur_begin, last, target);
+            } else if (target < cur_begin) {
+                std::rotate(target, cur_begin, last);
+            } else {
+                std::rotate(cur_begin, last, target + count);
+            }
+            cur_end = target + (cur_end - cur_begin);
+            cur_begin = target;
+        }
+
+        // moves the slots [first, last) into a new map with `slots` slots (plus the end slot),
+        // placing them starting at index `offset`; the slots outside [first, last) must be null
+        void move_map(T** first, T** last, size_t slots, size_t offset) {
+            cancel_migration();
+            drop_retired_map();
+            size_t old_size = static_cast<size_t>(end - begin) + 1;
+            T** new_arr = allocate_map(slots + 1);
+            std::fill(new_arr, new_arr + slots + 1, nullptr);
+            std::copy(first, last, new_arr + offset);
+
+            auto diff = cur_end - cur_begin;
+            cur_begin = new_arr + offset + (cur_begin - first);
+            cur_end = cur_begin + diff;
+            if (owns_map()) {
+                deallocate_map(begin, old_size);
+            }
+
+            begin = new_arr;
+            end = begin + slots;
+        }
+
+        // moves the map into a new one with `slots` slots (plus the end slot),
+        // the old slots are placed starting at index `offset`
+        void reallocate(size_t slots, size_t offset) {
+            move_map(begin, end, slots, offset);
+        }
+
+        // number of slots in front of cur_begin and behind cur_end
+        size_t front_slots() const {
+            return static_cast<size_t>(cur_begin - begin);
+        }
+
+        size_t back_slots() const {
+            return cur_end < end ? static_cast<size_t>(end - cur_end) - 1 : 0;
+        }
+
+        // frees the chunks in [first, last)
+        void release(T** first, T** last) {
+            for (; first < last; ++first) {
+                if (*first) {
+                    deallocate_chunk(*first);
+                    set(first, nullptr);
+                }
+            }
+        }
+
+        // frees the chunks more than `spare` slots away from [cur_begin, cur_end]
+        void trim(size_t spare) {
+            release(begin, cur_begin - std::min(spare, front_slots()));
+            release(cur_end + 1 + std::min(spare, back_slots()), end);
+        }
+
+        // moves the chunks more than `spare` (and at most `spare` + `reach`) slots away from
+        // [cur_begin, cur_end] into the empty slots within that distance, the back ones first
+        void gather(size_t spare, size_t reach = SIZE_MAX) {
+            T** first = cur_begin - std::min(spare, front_slots());
+            T** last = std::min(cur_end + 1, end) + std::min(spare, back_slots());
+            T** back = cur_end;
+            T** front = cur_begin;
+            auto place = [&](T*& chunk) {
+                for (; back < last; ++back) {
+                    if (!*back) {
+                        *back = std::exchange(chunk, nullptr);
+                        return true;
+                    }
+                }
+                while (front > first) {
+                    if (!*--front) {
+                        *front = std::exchange(chunk, nullptr);
+                        return true;
+                    }
+                }
+                return false;
+            };
+            for (T** it = first - std::min(reach, static_cast<size_t>(first - begin)); it < first; ++it) {
+                if (*it && !place(*it)) {
+                    return;
+                }
+            }
+            for (T** it = last; it < last + std::min(reach, static_cast<size_t>(end - last)); ++it) {
+                if (*it && !place(*it)) {
+                    return;
+                }
+            }
+        }
+
+        // trims the map and moves what is left into a new map `factor` times larger, centered in it
+        void shrink(size_t spare, size_t factor) {
+            trim(spare);
+            T** first = cur_begin - std::min(spare, front_slots());
+            T** last = std::min(cur_end + 1, end) + std::min(spare, back_slots());
+            auto kept = static_cast<size_t>(last - first);
+            move_map(first, last, factor * kept, (factor - 1) * kept / 2);
+        }
+
+        void update(bool at_front) {
+            auto [slots, front] = next_layout(at_front);
+            relocate(slots, front);
+        }
+
+        // makes [cur_end, cur_end + count) ordinary slots of the map
+        void reserve_back(size_t count) {
+            auto used = static_cast<size_t>(cur_end - begin);
+            if (used + count <= static_cast<size_t>(end - begin)) {
+                return;
+            }
+            size_t old_size = static_cast<size_t>(end - begin) + 1;
+            reallocate(std::max(Policy::map_growth_factor * old_size, used + count), 0);
+        }
+
+        // makes [cur_begin - count, cur_begin) slots of the map
+        void reserve_front(size_t count) {
+            auto used = static_cast<size_t>(end - cur_begin);
+            if (static_cast<size_t>(cur_begin - begin) >= count) {
+                return;
+            }
+            size_t old_size = static_cast<size_t>(end - begin) + 1;
+            size_t slots = std::max(Policy::map_growth_factor * old_size, used + count);
+            reallocate(slots, slots - (old_size - 1));
+        }
+
+        ~ChunkArray() {
+            cancel_migration();
+            drop_retired_map();
+            if (!owns_map()) {
+                return;
+            }
+            for (auto it = begin; it < end; ++it) {
+                if (*it) {
+                    deallocate_chunk(*it);
+                }
+            }
+            deallocate_map(begin, static_cast<size_t>(end - begin) + 1);
         }
     };
 
-    using iterator = BaseIterator<T>;
-    using const_iterator = BaseIterator<const T>;
-    using reverse_iterator = std::reverse_iterator<iterator>;
-    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    ChunkArray arr;
+    size_t m_size;
+    T* m_begin;
+    T* m_end;
 
-    iterator begin() {
-        return iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    // m_end is null while it points to the beginning of a chunk that is
+    // not allocated yet, in particular to the (always null) end slot of the map
+    BaseDeque(size_t n, const Allocator& alloc) : arr(n, alloc),
+                                                  m_size(n),
+                                                  m_begin(*arr.cur_begin),
+                                                  m_end(arr.cur_begin[n / chunk_size] + n % chunk_size) {}
+
+    explicit BaseDeque(const Allocator& alloc) noexcept : arr(alloc),
+                                                          m_size(0),
+                                                          m_begin(nullptr),
+                                                          m_end(nullptr) {}
+
+    BaseDeque(BaseDeque&& other) noexcept : arr(std::move(other.arr)),
+                                            m_size(std::exchange(other.m_size, 0)),
+                                            m_begin(std::exchange(other.m_begin, nullptr)),
+                                            m_end(std::exchange(other.m_end, nullptr)) {}
+};
+
+template <typename T, typename Allocator = std::allocator<T>, typename Policy = DequePolicy>
+class Deque : BaseDeque<T, Allocator, Policy> {
+public:
+    using value_type = T;
+    using allocator_type = Allocator;
+
+private:
+    using Base = BaseDeque<T, Allocator, Policy>;
+    using alloc_traits = typename Base::alloc_traits;
+    using Base::chunk_size;
+    using Base::ptr_chunk_size;
+    using Base::arr;
+    using Base::m_begin;
+    using Base::m_end;
+    using Base::m_size;
+
+    static constexpr int chunk_shift = std::countr_zero(chunk_size);
+
+    // with Policy::incremental_map the next map is started once 1/migration_start of the map
+    // or less is left at the end the pushes go to
+    //NOLINTNEXTLINE(readability-magic-numbers)
+    static constexpr size_t migration_start = 4;
+
+    // the allocator constructs and destroys elements with placement new and plain destructor calls
+    static constexpr bool standard_allocator = std::is_same_v<Allocator, std::allocator<T>> ||
+                                               std::is_same_v<Allocator, std::pmr::polymorphic_allocator<T>>;
+    static constexpr bool bitwise_copyable = std::is_trivially_copyable_v<T> && standard_allocator;
+    static constexpr bool bitwise_relocatable = TriviallyRelocatable<T>::value && standard_allocator;
+
+    template <typename... Args>
+    void construct(T* ptr, Args&&... args) {
+        alloc_traits::construct(arr.alloc, ptr, std::forward<Args>(args)...);
     }
-    iterator end() {
-        return iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+
+    void destroy(T* ptr) {
+        alloc_traits::destroy(arr.alloc, ptr);
     }
 
-    const_iterator begin() const {
-        return iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    void swap_storage(Deque& tmp) {
+        arr.swap(tmp.arr);
+        std::swap(m_begin, tmp.m_begin);
+        std::swap(m_end, tmp.m_end);
+        std::swap(m_size, tmp.m_size);
     }
-    const_iterator end() const {
-        return iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+
+    void next_end() {
+        ++m_end;
+        ++m_size;
+        if (m_end == *arr.cur_end + chunk_size) {
+            ++arr.cur_end;
+            m_end = *arr.cur_end;
+        }
     }
 
-    const_iterator cbegin() const {
-        return const_iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    // rearranges the map once the front (back) of it is reached
+    void update(bool at_front) {
+        bool migrated = false;
+        if constexpr (Policy::incremental_map) {
+            // the migration started by prepare_back() (prepare_front()) is complete by now, apart from
+            // a rare change of direction of the pushes that leaves the new map full as well
+            migrated = arr.finish_migration() && arr.cur_begin != arr.begin && arr.cur_end != arr.end;
+        }
+        if (!migrated) {
+            arr.update(at_front);
+        }
+        // the rearrangement may have moved spare chunks anywhere in the map, a migration
+        // freed the ones far away already
+        if constexpr (Policy::recycle_chunks) {
+            arr.gather(Policy::spare_chunks, migrated ? Policy::spare_chunks + 1 : SIZE_MAX);
+        }
+        if (!migrated) {
+            arr.trim(Policy::spare_chunks);
+        }
+        if (!m_end) {
+            // the map was rearranged, a spare chunk may have moved under m_end
+            m_end = *arr.cur_end;
+            if (!m_begin) {
+                m_begin = m_end;
+            }
+        }
     }
-    const_iterator cend() const {
-        return const_iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+
+    // allocates chunks so that n more elements fit at the back without touching the map
+    void reserve_back_chunks(size_t n) {
+        size_t room = m_end ? static_cast<size_t>(*arr.cur_end + chunk_size - m_end) : 0;
+        if (n <= room) {
+            return;
+        }
+        size_t slots = (n - room + chunk_size - 1) / chunk_size + (m_end ? 1 : 0);
+        arr.reserve_back(slots);
+        for (T** it = arr.cur_end; it < arr.cur_end + slots; ++it) {
+            if (!*it) {
+                arr.set(it, arr.allocate_chunk());
+            }
+        }
+        if (!m_end) {
+            m_end = *arr.cur_end;
+            if (!m_begin) {
+                m_begin = m_end;
+            }
+        }
     }
 
-    reverse_iterator rbegin() {
-        return reverse_iterator(end());
+    // the same for the front
+    void reserve_front_chunks(size_t n) {
+        auto room = static_cast<size_t>(m_begin - *arr.cur_begin);
+        if (n <= room) {
+            return;
+        }
+        size_t slots = (n - room + chunk_size - 1) / chunk_size;
+        arr.reserve_front(slots);
+        for (T** it = arr.cur_begin - slots; it < arr.cur_begin; ++it) {
+            if (!*it) {
+                arr.set(it, arr.allocate_chunk());
+            }
+        }
     }
-    reverse_iterator rend() {
-        return reverse_iterator(begin());
+
+    // constructs count elements at dst from src, returns the advanced src
+    template <typename It>
+    It construct_n(T* dst, size_t count, It src) {
+        if constexpr (bitwise_copyable && std::contiguous_iterator<It> &&
+                      std::is_same_v<std::iter_value_t<It>, T>) {
+            std::memcpy(dst, std::to_address(src), count * sizeof(T));
+            return src + static_cast<std::iter_difference_t<It>>(count);
+        } else if constexpr (std::is_same_v<It, ValueRepeater> && bitwise_copyable) {
+            // a vectorized fill, memset for single bytes
+            std::uninitialized_fill_n(dst, count, *src);
+            return src;
+        } else if constexpr (std::is_same_v<It, ValueInit> && bitwise_copyable) {
+            std::uninitialized_value_construct_n(dst, count);
+            return src;
+        } else if constexpr (std::is_same_v<It, DefaultInit> && bitwise_copyable) {
+            std::uninitialized_default_construct_n(dst, count);
+            return src;
+        } else {
+            size_t done = 0;
+            try {
+                for (; done < count; ++done, ++src) {
+                    if constexpr (std::is_same_v<It, ValueInit> || std::is_same_v<It, DefaultInit>) {
+                        construct(dst + done);
+                    } else {
+                        construct(dst + done, *src);
+                    }
+                }
+            } catch (...) {
+                for (size_t i = 0; i < done; ++i) {
+                    destroy(dst + i);
+                }
+                throw;
+            }
+            return src;
+        }
     }
 
-    const_reverse_iterator rbegin() const {
-        return const_reverse_iterator(end());
+    // a step of the incremental rearrangement of the map in progress, see DequePolicy::incremental_map
+    void migrate_map() {
+        if constexpr (Policy::incremental_map) {
+            if (arr.migrating()) {
+                arr.migrate();
+            }
+        }
     }
-    const_reverse_iterator rend() const {
-        return const_reverse_iterator(begin());
+
+    // makes sure the slot in front of m_begin lies in an allocated chunk
+    void prepare_front() {
+        migrate_map();
+        if (m_begin != *arr.cur_begin) {
+            return;
+        }
+        if (arr.cur_begin == arr.begin) {
+            update(true);
+        }
+        // past the budget of the allocator a spare chunk from the back will do
+        if (!*(arr.cur_begin - 1) && (arr.can_allocate_chunk() || !borrow_back_spare())) {
+            arr.set(arr.cur_begin - 1, arr.allocate_chunk());
+        }
+        if constexpr (Policy::incremental_map) {
+            if (!arr.migrating() && migration_start * arr.front_slots() <= static_cast<size_t>(arr.end - arr.begin)) {
+                arr.start_migration(arr.front_slots() * chunk_size, true);
+            }
+        }
     }
 
-    const_reverse_iterator crbegin() const {
-        return const_reverse_iterator(cend());
+    // the slot in front of m_begin, valid after prepare_front()
+    T* front_slot() const {
+        return m_begin != *arr.cur_begin ? m_begin - 1 : *(arr.cur_begin - 1) + chunk_size - 1;
     }
-    const_reverse_iterator crend() const {
-        return const_reverse_iterator(cbegin());
+
+    // moves m_begin one element back, the slot is expected to be constructed by the caller
+    void retreat_begin() {
+        if (m_begin == *arr.cur_begin) {
+            --arr.cur_begin;
+            m_begin = *arr.cur_begin + chunk_size;
+        }
+        --m_begin;
+        ++m_size;
+    }
+
+    // moves m_begin one element forward, the element there is left as is
+    void advance_begin() {
+        ++m_begin;
+        --m_size;
+        if (m_begin == *arr.cur_begin + chunk_size) {
+            ++arr.cur_begin;
+            m_begin = *arr.cur_begin;
+        }
     }
 
+    // moves m_end one element back, the element there is left as is
+    void retreat_end() {
+        if (m_end == *arr.cur_end) {
+            --arr.cur_end;
+            m_end = *arr.cur_end + chunk_size;
+        }
+        --m_end;
+        --m_size;
+    }
 
-    iterator insert(iterator iter, const T& val) {
-        if (iter == begin()) {
-            push_front(val);
-            return begin();
+    // moves m_begin count elements back, the chunks there are expected to be reserved
+    void retreat_begin(size_t count) {
+        ptrdiff_t offset = (m_begin - *arr.cur_begin) - static_cast<ptrdiff_t>(count);
+        arr.cur_begin += offset >> chunk_shift;
+        m_begin = *arr.cur_begin + (offset & (ptr_chunk_size - 1));
+        m_size += count;
+    }
+
+    // moves m_begin count elements forward, the elements there are left as is
+    void advance_begin(size_t count) {
+        ptrdiff_t offset = (m_begin - *arr.cur_begin) + static_cast<ptrdiff_t>(count);
+        arr.cur_begin += offset >> chunk_shift;
+        m_begin = *arr.cur_begin + (offset & (ptr_chunk_size - 1));
+        m_size -= count;
+    }
+
+    // moves m_end count elements forward, the chunks there are expected to be reserved
+    void advance_end(size_t count) {
+        ptrdiff_t offset = (m_end - *arr.cur_end) + static_cast<ptrdiff_t>(count);
+        arr.cur_end += offset >> chunk_shift;
+        m_end = *arr.cur_end + (offset & (ptr_chunk_size - 1));
+        m_size += count;
+    }
+
+    // moves m_end count elements back, the elements there are left as is
+    void retreat_end(size_t count) {
+        ptrdiff_t offset = (m_end - *arr.cur_end) - static_cast<ptrdiff_t>(count);
+        arr.cur_end += offset >> chunk_shift;
+        m_end = *arr.cur_end + (offset & (ptr_chunk_size - 1));
+        m_size -= count;
+    }
+
+    // called when a chunk has drained at the front (back): recycles to the other end or frees the
+    // chunk there that has just become one spare too many and shrinks a mostly unused map, see DequePolicy
+    void reclaim_front() {
+        if (arr.front_slots() > Policy::spare_chunks) {
+            T** drained = arr.cur_begin - Policy::spare_chunks - 1;
+            // near the end of the map the chunk is kept for the coming update() to gather
+            if (!Policy::recycle_chunks || (!recycle_to_back(drained) && arr.back_slots() >= Policy::spare_chunks)) {
+                arr.release(drained, drained + 1);
+            }
         }
-        if (iter == end()) {
-            push_back(val);
-            return --end();
+        shrink_sparse_map();
+    }
+
+    void reclaim_back() {
+        if (arr.back_slots() > Policy::spare_chunks) {
+            T** drained = arr.cur_end + Policy::spare_chunks + 1;
+            if (!Policy::recycle_chunks || (!recycle_to_front(drained) && arr.front_slots() >= Policy::spare_chunks)) {
+                arr.release(drained, drained + 1);
+            }
         }
+        shrink_sparse_map();
+    }
 
-        auto ind = iter - begin();
-        if (arr.cur_end == arr.end) {
-            update();
+    // moves the chunk of slot into the nearest empty slot among the spare_chunks slots behind
+    // the elements (the slot of m_end itself included), returns false if they are all taken
+    bool recycle_to_back(T** slot) {
+        if (!*slot || arr.cur_end == arr.end) {
+            return false;
+        }
+        T** last = arr.cur_end + 1 + std::min(Policy::spare_chunks, arr.back_slots());
+        for (T** it = m_end ? arr.cur_end + 1 : arr.cur_end; it < last; ++it) {
+            if (!*it) {
+                arr.set(it, *slot);
+                arr.set(slot, nullptr);
+                if (it == arr.cur_end) {
+                    m_end = *it;
+                    m_begin = m_begin ? m_begin : m_end;
+                }
+                return true;
+            }
         }
+        return false;
+    }
 
-        new(m_end) T(back());
+    // the same for the spare_chunks slots in front of the elements
+    bool recycle_to_front(T** slot) {
+        if (!*slot) {
+            return false;
+        }
+        T** first = arr.cur_begin - std::min(Policy::spare_chunks, arr.front_slots());
+        for (T** it = arr.cur_begin; it > first;) {
+            if (!*--it) {
+                arr.set(it, *slot);
+                arr.set(slot, nullptr);
+                return true;
+            }
+        }
+        return false;
+    }
 
-        auto ans = begin() + ind;
-        for (auto it = --end(); it != ans; --it) {
-            *it = *(it - 1);
+    // moves a spare chunk from the front into the slot of m_end, false if there is none
+    bool borrow_front_spare() {
+        for (T** it = arr.cur_begin - std::min(Policy::spare_chunks, arr.front_slots()); it < arr.cur_begin; ++it) {
+            if (recycle_to_back(it)) {
+                return true;
+            }
         }
-        *ans = val;
-        next_end();
-        return ans;
+        return false;
     }
 
-    iterator erase(iterator iter) {
-        if (iter == begin()) {
-            pop_front();
-            return begin();
+    // moves a spare chunk from the back into the slot in front of m_begin, false if there is none
+    bool borrow_back_spare() {
+        for (T** it = arr.cur_end + std::min(Policy::spare_chunks, arr.back_slots()); it > arr.cur_end; --it) {
+            if (recycle_to_front(it)) {
+                return true;
+            }
         }
-        for (auto it = iter; it + 1 != end(); ++it) {
-            *it = *(it + 1);
+        return false;
+    }
+
+    void shrink_sparse_map() {
+        if constexpr (Policy::map_shrink_ratio > 0) {
+            auto used = static_cast<size_t>(arr.cur_end - arr.cur_begin) + 1;
+            if (used * Policy::map_shrink_ratio < static_cast<size_t>(arr.end - arr.begin) + 1) {
+                arr.shrink(Policy::spare_chunks, Policy::map_growth_factor);
+            }
         }
-        pop_back();
-        return iter;
     }
 
-    ~Deque() {
-        std::destroy(begin(), end());
+    // makes m_end point into an allocated chunk
+    void prepare_back() {
+        if (arr.cur_end == arr.end) {
+            update(false);
+        }
+        if (!m_end && (arr.can_allocate_chunk() || !borrow_front_spare())) {
+            arr.set(arr.cur_end, arr.allocate_chunk());
+            m_end = *arr.cur_end;
+            if (!m_begin) {
+                m_begin = m_end;
+            }
+        }
+        if constexpr (Policy::incremental_map) {
+            if (arr.migrating()) {
+                arr.migrate();
+            } else if (m_end == *arr.cur_end &&
+                       migration_start * arr.back_slots() <= static_cast<size_t>(arr.end - arr.begin)) {
+                // a chunk is started with 1/migration_start of the map or less left behind it
+                arr.start_migration((arr.back_slots() + 1) * chunk_size, false);
+            }
+        }
     }
-};
+
+    // prepare_back() (prepare_front()) if what it allocates fits into the budget of the allocator,
+    // otherwise false; the map may have been rearranged in place by then
+    bool try_prepare_back() {
+        static_assert(!Policy::incremental_map, "an incremental migration allocates its map ahead of time");
+        if (arr.cur_end == arr.end) {
+            if (!arr.can_update(false)) {
+                return false;
+            }
+            update(false);
+        }
+        if (!m_end && !arr.can_allocate_chunk() && !borrow_front_spare()) {
+            return false;
+        }
+        prepare_back();
+        return true;
+    }
+
+    bool try_prepare_front() {
+        static_assert(!Policy::incremental_map, "an incremental migration allocates its map ahead of time");
+        if (m_begin != *arr.cur_begin) {
+            return true;
+        }
+        if (arr.cur_begin == arr.begin) {
+            if (!arr.can_update(true)) {
+                return false;
+            }
+            update(true);
+        }
+        if (!*(arr.cur_begin - 1) && !arr.can_allocate_chunk() && !borrow_back_spare()) {
+            return false;
+        }
+        prepare_front();
+        return true;
+    }
+
+public:
+    // an empty deque allocates nothing, the storage appears with the first element
+    Deque() noexcept(noexcept(Allocator())) : Deque(Allocator()) {}
+
+    explicit Deque(const Allocator& alloc) noexcept : Base(alloc) {}
+
+    explicit Deque(size_t n, const Allocator& alloc = Allocator()) : Base(n, alloc) {
+        static_assert(std::is_default_constructible<T>::value);
+        construct_at(begin(), n, ValueInit{});
+    }
+
+    Deque(const Deque& copy) : Deque(copy, alloc_traits::select_on_container_copy_construction(copy.get_allocator())) {}
+
+    Deque(const Deque& copy, const Allocator& alloc) : Base(copy.size(), alloc) {
+        construct_from_segments(copy);
+    }
+
+    Deque(size_t n, const T& val, const Allocator& alloc = Allocator()) : Base(n, alloc) {
+        construct_at(begin(), n, ValueRepeater{&val});
+    }
+
+    Deque(Deque&& other) noexcept = default;
+
+    Deque(Deque&& other, const Allocator& alloc) : Base(alloc) {
+        if (alloc == other.get_allocator()) {
+            swap_storage(other);
+        } else {
+            move_elements_from(other);
+        }
+    }
+
+    allocator_type get_allocator() const {
+        return arr.alloc;
+    }
+
+    void swap(Deque& tmp) {
+        swap_storage(tmp);
+        if constexpr (alloc_traits::propagate_on_container_swap::value) {
+            std::swap(arr.alloc, tmp.arr.alloc);
+        }
+    }
+
+    Deque& operator=(const Deque& other) {
+        if (this != &other) {
+            constexpr bool propagate = alloc_traits::propagate_on_container_copy_assignment::value;
+            Deque copy(other, propagate ? other.get_allocator() : get_allocator());
+            swap_storage(copy);
+            if constexpr (propagate) {
+                std::swap(arr.alloc, copy.arr.alloc);
+            }
+        }
+        return *this;
+    }
+
+    Deque& operator=(Deque&& other) noexcept(alloc_traits::propagate_on_container_move_assignment::value ||
+                                             alloc_traits::is_always_equal::value) {
+        if (this == &other) {
+            return *this;
+        }
+        if constexpr (alloc_traits::propagate_on_container_move_assignment::value) {
+            Deque tmp(std::move(other));
+            swap_storage(tmp);
+            std::swap(arr.alloc, tmp.arr.alloc);
+        } else {
+            Deque tmp(std::move(other), get_allocator());
+            swap_storage(tmp);
+        }
+        return *this;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    template <typename... Args>
+    T& emplace_front(Args&&... args) {
+        // an empty deque has no m_begin, the null check lets the compiler see that too
+        if (m_begin != nullptr && m_begin != *arr.cur_begin) {
+            migrate_map();
+            auto ptr = m_begin - 1;
+            construct(ptr, std::forward<Args>(args)...);
+            --m_begin;
+            ++m_size;
+            return *m_begin;
+        }
+
+        prepare_front();
+        construct(*(arr.cur_begin - 1) + chunk_size - 1, std::forward<Args>(args)...);
+        retreat_begin();
+        return *m_begin;
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (Policy::incremental_map || !m_end) {
+            prepare_back();
+        }
+
+        T* ptr = m_end;
+        construct(ptr, std::forward<Args>(args)...);
+        next_end();
+        return *ptr;
+    }
+
+    void push_front(const T& val) {
+        emplace_front(val);
+    }
+
+    void push_front(T&& val) {
+        emplace_front(std::move(val));
+    }
+
+    void push_back(const T& val) {
+        emplace_back(val);
+    }
+
+    void push_back(T&& val) {
+        emplace_back(std::move(val));
+    }
+
+    // Pushes that return false instead of allocating past the budget of the allocator, see
+    // RealtimeAllocator; with other allocators they allocate as usual. A failed push leaves
+    // the elements alone, but may have rearranged the map, which invalidates iterators.
+    template <typename... Args>
+    bool try_emplace_front(Args&&... args) {
+        if (!try_prepare_front()) {
+            return false;
+        }
+        construct(front_slot(), std::forward<Args>(args)...);
+        retreat_begin();
+        return true;
+    }
+
+    template <typename... Args>
+    bool try_emplace_back(Args&&... args) {
+        if (!m_end && !try_prepare_back()) {
+            return false;
+        }
+        construct(m_end, std::forward<Args>(args)...);
+        next_end();
+        return true;
+    }
+
+    bool try_push_front(const T& val) {
+        return try_emplace_front(val);
+    }
+
+    bool try_push_front(T&& val) {
+        return try_emplace_front(std::move(val));
+    }
+
+    bool try_push_back(const T& val) {
+        return try_emplace_back(val);
+    }
+
+    bool try_push_back(T&& val) {
+        return try_emplace_back(std::move(val));
+    }
+
+    void pop_front() {
+        destroy(m_begin);
+        advance_begin();
+        if (m_begin == *arr.cur_begin) {
+            reclaim_front();
+        }
+    }
+
+    void pop_back() {
+        bool drained = m_end == *arr.cur_end;
+        retreat_end();
+        destroy(m_end);
+        if (drained) {
+            reclaim_back();
+        }
+    }
+
+    // Make room for n more push_back (push_front) calls that neither allocate nor touch the map.
+    // Pops give the chunks beyond DequePolicy::spare_chunks back again, and so does a push at
+    // the other end that has to rearrange the map.
+    void reserve_back(size_t n) {
+        reserve_back_chunks(n);
+    }
+
+    void reserve_front(size_t n) {
+        reserve_front_chunks(n);
+    }
+
+    // the number of elements that can be pushed at the back (front) without allocating
+    size_t capacity_back() const {
+        if (!m_end) {
+            return 0;
+        }
+        T** last = arr.cur_end + 1;
+        while (last < arr.end && *last) {
+            ++last;
+        }
+        return static_cast<size_t>(*arr.cur_end + chunk_size - m_end) +
+               chunk_size * static_cast<size_t>(last - arr.cur_end - 1);
+    }
+
+    size_t capacity_front() const {
+        T** first = arr.cur_begin;
+        while (first > arr.begin && *(first - 1)) {
+            --first;
+        }
+        return static_cast<size_t>(m_begin - *arr.cur_begin) +
+               chunk_size * static_cast<size_t>(arr.cur_begin - first);
+    }
+
+    // frees every chunk that holds no elements and reallocates the map to fit the used chunks exactly
+    void shrink_to_fit() {
+        if (empty()) {
+            typename Base::ChunkArray released(std::move(arr));
+            m_begin = nullptr;
+            m_end = nullptr;
+            return;
+        }
+        if (m_end && m_end == *arr.cur_end) {
+            arr.release(arr.cur_end, arr.cur_end + 1);
+            m_end = nullptr;
+        }
+        arr.shrink(0, 1);
+    }
+
+    T& operator[](size_t ind) {
+        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
+        return arr.cur_begin[ind / chunk_size][ind % chunk_size];
+    }
+
+    const T& operator[](size_t ind) const {
+        ind += static_cast<size_t>(m_begin - *arr.cur_begin);
+        return arr.cur_begin[ind / chunk_size][ind % chunk_size];
+    }
+
+    T& at(size_t ind) {
+        if (ind >= m_size) {
+            throw std::out_of_range("Deque index out of range");
+        }
+        return (*this)[ind];
+    }
+
+    const T& at(size_t ind) const {
+        if (ind >= m_size) {
+            throw std::out_of_range("Deque index out of range");
+        }
+        return (*this)[ind];
+    }
+
+    T& front() {
+        return *m_begin;
+    }
+
+    const T& front() const {
+        return *m_begin;
+    }
+
+    T& back() {
+        return *rbegin();
+    }
+
+    const T& back() const {
+        return *crbegin();
+    }
+
+
+    template <typename Value>
+    struct BaseIterator {
+    public:
+        using difference_type = ptrdiff_t;
+        using value_type = std::remove_cv_t<Value>;
+        using pointer = Value*;
+        using reference = Value&;
+        using iterator_category = std::random_access_iterator_tag;
+
+    private:
+        friend class Deque;
+
+        pointer item = nullptr;
+        T** cur_arr = nullptr;
+
+        T** first = nullptr;
+        T** last = nullptr;
+
+    public:
+        BaseIterator() = default;
+
+        BaseIterator(pointer item, T** cur_arr, T** first, T** last) : item(item),
+                                                                       cur_arr(cur_arr),
+                                                                       first(first),
+                                                                       last(last) {}
+
+        operator BaseIterator<const Value>() const {
+            return BaseIterator<const Value>(item, cur_arr, first, last);
+        }
+
+        reference operator*() const {
+            return *item;
+        }
+
+        pointer operator->() const {
+            return item;
+        }
+
+        BaseIterator& operator++() {
+            ++item;
+            if (cur_arr < last && item == *cur_arr + ptr_chunk_size) {
+                ++cur_arr;
+                item = *cur_arr;
+            }
+            return *this;
+        }
+
+        BaseIterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        BaseIterator& operator--() {
+            if (item == *cur_arr) {
+                if (cur_arr == first) {
+                    // already at the very beginning (possibly of an empty deque without chunks)
+                    return *this;
+                }
+                --cur_arr;
+                item = *cur_arr + ptr_chunk_size;
+            }
+            --item;
+            return *this;
+        }
+
+        BaseIterator operator--(int) {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        BaseIterator& operator+=(difference_type diff) {
+            // position relative to the beginning of the first chunk;
+            // chunk_size is a power of two, so the shift is a floor division
+            difference_type pos = (cur_arr - first) * ptr_chunk_size + (item - *cur_arr) + diff;
+            difference_type chunk = std::clamp<difference_type>(pos >> chunk_shift, 0, last - first);
+            cur_arr = first + chunk;
+            item = *cur_arr + (pos - chunk * ptr_chunk_size);
+            return *this;
+        }
+
+        BaseIterator& operator-=(difference_type diff) {
+            return *this += -diff;
+        }
+
+        BaseIterator operator+(difference_type diff) const {
+            BaseIterator copy = *this;
+            copy += diff;
+            return copy;
+        }
+
+        BaseIterator operator-(difference_type diff) const {
+            return *this + (-diff);
+        }
+
+        difference_type operator-(const BaseIterator& it) const {
+            return ptr_chunk_size * (cur_arr - it.cur_arr) + (item - *cur_arr) - (it.item - *it.cur_arr);
+        }
+
+        friend BaseIterator operator+(difference_type diff, const BaseIterator& it) {
+            return it + diff;
+        }
+
+        reference operator[](difference_type diff) const {
+            return *(*this + diff);
+        }
+
+        bool operator==(const BaseIterator& other) const {
+            return item == other.item;
+        }
+        bool operator!=(const BaseIterator& other) const {
+            return item != other.item;
+        }
+
+        auto operator<=>(const BaseIterator& other) const {
+            return cur_arr == other.cur_arr ? item <=> other.item : cur_arr <=> other.cur_arr;
+        }
+
+        // the contiguous pieces of [first, last), one std::span per chunk
+        friend auto segments(BaseIterator first, BaseIterator last) {
+            return make_segments(first, last);
+        }
+
+    private:
+        static auto make_segments(BaseIterator first, BaseIterator last) {
+            T** slot_end = first == last || last.item == *last.cur_arr ? last.cur_arr : last.cur_arr + 1;
+            return std::views::iota(first.cur_arr, std::max(first.cur_arr, slot_end)) |
+                   std::views::transform([first, last](T** slot) {
+                       return std::span<Value>(slot == first.cur_arr ? first.item : *slot,
+                                               slot == last.cur_arr ? last.item : *slot + ptr_chunk_size);
+                   });
+        }
+    };
+
+    using iterator = BaseIterator<T>;
+    using const_iterator = BaseIterator<const T>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+    // copies the elements of other into the raw slots of a freshly allocated deque of the same
+    // size, one contiguous run of both deques at a time (memcpy for trivially copyable types)
+    void construct_from_segments(const Deque& other) {
+        size_t done = 0;
+        try {
+            for (auto segment : other.segments()) {
+                construct_at(begin() + static_cast<ptrdiff_t>(done), segment.size(), segment.data());
+                done += segment.size();
+            }
+        } catch (...) {
+            destroy_range(begin(), begin() + static_cast<ptrdiff_t>(done));
+            throw;
+        }
+    }
+
+    template <typename It>
+    void append_n(It src, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        reserve_back_chunks(count);
+        iterator old_end = end();
+        size_t old_size = m_size;
+        try {
+            while (count > 0) {
+                size_t span = std::min(count, static_cast<size_t>(*arr.cur_end + chunk_size - m_end));
+                src = construct_n(m_end, span, src);
+                count -= span;
+                m_size += span;
+                m_end += span;
+                if (m_end == *arr.cur_end + chunk_size) {
+                    ++arr.cur_end;
+                    m_end = *arr.cur_end;
+                }
+            }
+        } catch (...) {
+            destroy_range(old_end, end());
+            arr.cur_end = old_end.cur_arr;
+            m_end = old_end.item;
+            m_size = old_size;
+            throw;
+        }
+    }
+
+    template <typename It>
+    void prepend_n(It src, size_t count) {
+        reserve_front_chunks(count);
+        ptrdiff_t offset = (m_begin - *arr.cur_begin) - static_cast<ptrdiff_t>(count);
+        T** slot = arr.cur_begin + (offset >> chunk_shift);
+        iterator new_begin(*slot + (offset & (ptr_chunk_size - 1)), slot, slot, arr.cur_end);
+        T* dst = new_begin.item;
+        size_t done = 0;
+        try {
+            while (done < count) {
+                size_t span = std::min(count - done, static_cast<size_t>(*slot + chunk_size - dst));
+                src = construct_n(dst, span, src);
+                done += span;
+                dst = *++slot;
+            }
+        } catch (...) {
+            destroy_range(new_begin, new_begin + static_cast<ptrdiff_t>(done));
+            throw;
+        }
+        arr.cur_begin = new_begin.cur_arr;
+        m_begin = new_begin.item;
+        m_size += count;
+    }
+
+    // destroys all elements, keeping the chunks for reuse
+    void destroy_all() {
+        destroy_range(begin(), end());
+        m_end = m_begin;
+        arr.cur_end = arr.cur_begin;
+        m_size = 0;
+    }
+
+    void destroy_range(iterator first, iterator last) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (; first != last; ++first) {
+                destroy(&*first);
+            }
+        }
+    }
+
+    // memmove counterpart of std::move_backward for bitwise relocatable elements,
+    // copies one contiguous run (bounded by the chunks of both ranges) at a time
+    void relocate_backward(iterator first, iterator last, iterator d_last) {
+        auto count = last - first;
+        T** src_slot = last.cur_arr;
+        T* src = last.item;
+        T** dst_slot = d_last.cur_arr;
+        T* dst = d_last.item;
+        while (count > 0) {
+            if (src == *src_slot) {
+                src = *--src_slot + chunk_size;
+            }
+            if (dst == *dst_slot) {
+                dst = *--dst_slot + chunk_size;
+            }
+            auto run = std::min({count, src - *src_slot, dst - *dst_slot});
+            src -= run;
+            dst -= run;
+            std::memmove(static_cast<void*>(dst), static_cast<const void*>(src), static_cast<size_t>(run) * sizeof(T));
+            count -= run;
+        }
+    }
+
+    // memmove counterpart of std::move
+    void relocate_forward(iterator first, iterator last, iterator d_first) {
+        auto count = last - first;
+        T** src_slot = first.cur_arr;
+        T* src = first.item;
+        T** dst_slot = d_first.cur_arr;
+        T* dst = d_first.item;
+        while (count > 0) {
+            if (src == *src_slot + chunk_size) {
+                src = *++src_slot;
+            }
+            if (dst == *dst_slot + chunk_size) {
+                dst = *++dst_slot;
+            }
+            auto run = std::min({count, *src_slot + ptr_chunk_size - src, *dst_slot + ptr_chunk_size - dst});
+            std::memmove(static_cast<void*>(dst), static_cast<const void*>(src), static_cast<size_t>(run) * sizeof(T));
+            src += run;
+            dst += run;
+            count -= run;
+        }
+    }
+
+    // constructs count elements from src into the raw slots starting at dst, a chunk at a time
+    template <typename It>
+    void construct_at(iterator dst, size_t count, It src) {
+        T** slot = dst.cur_arr;
+        T* ptr = dst.item;
+        size_t done = 0;
+        try {
+            while (done < count) {
+                if (ptr == *slot + chunk_size) {
+                    ptr = *++slot;
+                }
+                size_t span = std::min(count - done, static_cast<size_t>(*slot + chunk_size - ptr));
+                src = construct_n(ptr, span, src);
+                done += span;
+                ptr += span;
+            }
+        } catch (...) {
+            destroy_range(dst, dst + static_cast<ptrdiff_t>(done));
+            throw;
+        }
+    }
+
+    // inserts count elements from src at index ind, moving the shorter side of the deque
+    // by count in one pass
+    template <typename It>
+    iterator insert_n(ptrdiff_t ind, It src, size_t count) {
+        auto shift = static_cast<ptrdiff_t>(count);
+        if (static_cast<size_t>(ind) < m_size - static_cast<size_t>(ind)) {
+            if constexpr (bitwise_relocatable) {
+                reserve_front_chunks(count);
+                retreat_begin(count);
+                relocate_forward(begin() + shift, begin() + shift + ind, begin());
+                try {
+                    construct_at(begin() + ind, count, src);
+                } catch (...) {
+                    relocate_backward(begin(), begin() + ind, begin() + ind + shift);
+                    advance_begin(count);
+                    throw;
+                }
+            } else {
+                prepend_n(src, count);
+                std::rotate(begin(), begin() + shift, begin() + shift + ind);
+            }
+            return begin() + ind;
+        }
+        auto old_size = static_cast<ptrdiff_t>(m_size);
+        if constexpr (bitwise_relocatable) {
+            reserve_back_chunks(count);
+            advance_end(count);
+            relocate_backward(begin() + ind, begin() + old_size, end());
+            try {
+                construct_at(begin() + ind, count, src);
+            } catch (...) {
+                relocate_forward(begin() + ind + shift, end(), begin() + ind);
+                retreat_end(count);
+                throw;
+            }
+        } else {
+            append_n(src, count);
+            std::rotate(begin() + ind, begin() + old_size, end());
+        }
+        return begin() + ind;
+    }
+
+    // yields the same value forever, lets the fill operations share the copying code
+    struct ValueRepeater {
+        using value_type = T;
+
+        const T& operator*() const {
+            return *value;
+        }
+        ValueRepeater& operator++() {
+            return *this;
+        }
+
+        const T* value;
+    };
+
+    // sources of value-initialized and default-initialized elements; only trivially copyable
+    // elements of the standard allocators are default-initialized, the rest go through the
+    // allocator, which can only value-initialize
+    struct ValueInit {
+        using value_type = T;
+
+        ValueInit& operator++() {
+            return *this;
+        }
+    };
+
+    struct DefaultInit {
+        using value_type = T;
+
+        DefaultInit& operator++() {
+            return *this;
+        }
+    };
+
+    void move_elements_from(Deque& other) {
+        for (auto& item : other) {
+            emplace_back(std::move(item));
+        }
+    }
+
+    void destroy_until(iterator it) {
+        for (auto cur = begin(); cur != it; ++cur) {
+            destroy(&*cur);
+        }
+    }
+
+public:
+
+    iterator begin() {
+        return iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    }
+    iterator end() {
+        return iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+    }
+
+    const_iterator begin() const {
+        return iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    }
+    const_iterator end() const {
+        return iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+    }
+
+    const_iterator cbegin() const {
+        return const_iterator(m_begin, arr.cur_begin, arr.cur_begin, arr.cur_end);
+    }
+    const_iterator cend() const {
+        return const_iterator(m_end, arr.cur_end, arr.cur_begin, arr.cur_end);
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    auto segments() {
+        return iterator::make_segments(begin(), end());
+    }
+
+    auto segments() const {
+        return const_iterator::make_segments(begin(), end());
+    }
+
+    // calls fn with every chunk's worth of elements as a std::span, in order
+    template <typename Fn>
+    void for_each_segment(Fn fn) {
+        for (auto segment : segments()) {
+            fn(segment);
+        }
+    }
+
+    template <typename Fn>
+    void for_each_segment(Fn fn) const {
+        for (auto segment : segments()) {
+            fn(segment);
+        }
+    }
+
+    const_reverse_iterator crbegin() const {
+        return const_reverse_iterator(cend());
+    }
+    const_reverse_iterator crend() const {
+        return const_reverse_iterator(cbegin());
+    }
+
+
+    template <std::ranges::input_range R>
+    void append_range(R&& range) {
+        if constexpr (std::ranges::forward_range<R> || std::ranges::sized_range<R>) {
+            append_n(std::ranges::begin(range), static_cast<size_t>(std::ranges::distance(range)));
+        } else {
+            size_t old_size = m_size;
+            try {
+                for (auto&& item : range) {
+                    emplace_back(std::forward<decltype(item)>(item));
+                }
+            } catch (...) {
+                while (m_size > old_size) {
+                    pop_back();
+                }
+                throw;
+            }
+        }
+    }
+
+    template <std::ranges::input_range R>
+    void prepend_range(R&& range) {
+        if constexpr (std::ranges::forward_range<R> || std::ranges::sized_range<R>) {
+            if (empty()) {
+                append_range(std::forward<R>(range));
+            } else {
+                prepend_n(std::ranges::begin(range), static_cast<size_t>(std::ranges::distance(range)));
+            }
+        } else {
+            Deque tmp(get_allocator());
+            tmp.append_range(std::forward<R>(range));
+            prepend_range(std::ranges::subrange(std::make_move_iterator(tmp.begin()),
+                                                std::make_move_iterator(tmp.end())));
+        }
+    }
+
+    template <std::ranges::input_range R>
+    void assign_range(R&& range) {
+        destroy_all();
+        append_range(std::forward<R>(range));
+    }
+
+    template <std::input_iterator InputIt>
+    void assign(InputIt first, InputIt last) {
+        assign_range(std::ranges::subrange(first, last));
+    }
+
+    void assign(std::initializer_list<T> list) {
+        assign_range(list);
+    }
+
+    void assign(size_t n, const T& val) {
+        // val may be an element of the deque
+        T copy(val);
+        destroy_all();
+        append_n(ValueRepeater{&copy}, n);
+    }
+
+    // destroys all elements, the chunks stay for reuse until shrink_to_fit
+    void clear() {
+        destroy_all();
+    }
+
+    // Grow or shrink the deque at the back (resize_front: at the front) to n elements.
+    // New elements are value-initialized or copies of val; resize_for_overwrite leaves them
+    // default-initialized, i.e. uninitialized for trivial types, to be filled by the caller.
+    void resize(size_t n) {
+        if (n <= m_size) {
+            erase(begin() + static_cast<ptrdiff_t>(n), end());
+        } else {
+            append_n(ValueInit{}, n - m_size);
+        }
+    }
+
+    void resize(size_t n, const T& val) {
+        if (n <= m_size) {
+            erase(begin() + static_cast<ptrdiff_t>(n), end());
+        } else {
+            // elements never move on append, so val stays valid even if it is one of them
+            append_n(ValueRepeater{&val}, n - m_size);
+        }
+    }
+
+    void resize_for_overwrite(size_t n) {
+        if (n <= m_size) {
+            erase(begin() + static_cast<ptrdiff_t>(n), end());
+        } else {
+            append_n(DefaultInit{}, n - m_size);
+        }
+    }
+
+    void resize_front(size_t n) {
+        if (n <= m_size) {
+            erase(begin(), end() - static_cast<ptrdiff_t>(n));
+        } else {
+            prepend_n(ValueInit{}, n - m_size);
+        }
+    }
+
+    template <typename... Args>
+    iterator emplace(iterator iter, Args&&... args) {
+        if (iter == begin()) {
+            emplace_front(std::forward<Args>(args)...);
+            return begin();
+        }
+        if (iter == end()) {
+            emplace_back(std::forward<Args>(args)...);
+            return --end();
+        }
+
+        // args may refer to an element of the deque, so build the value before shifting
+        T val(std::forward<Args>(args)...);
+        auto ind = iter - begin();
+        if (static_cast<size_t>(ind) < m_size - static_cast<size_t>(ind)) {
+            return emplace_shifting_front(ind, std::move(val));
+        }
+        if (!m_end) {
+            prepare_back();
+        }
+
+        auto ans = begin() + ind;
+        if constexpr (bitwise_relocatable) {
+            relocate_backward(ans, end(), end() + 1);
+            try {
+                construct(&*ans, std::move(val));
+            } catch (...) {
+                relocate_forward(ans + 1, end() + 1, ans);
+                throw;
+            }
+        } else {
+            construct(m_end, std::move(back()));
+            for (auto it = --end(); it != ans; --it) {
+                *it = std::move(*(it - 1));
+            }
+            *ans = std::move(val);
+        }
+        next_end();
+        return ans;
+    }
+
+private:
+    // inserts val at index ind by moving the ind elements in front of it one step to the front
+    iterator emplace_shifting_front(ptrdiff_t ind, T&& val) {
+        prepare_front();
+        if constexpr (bitwise_relocatable) {
+            retreat_begin();
+            relocate_forward(begin() + 1, begin() + ind + 1, begin());
+            try {
+                construct(&*(begin() + ind), std::move(val));
+            } catch (...) {
+                relocate_backward(begin(), begin() + ind, begin() + ind + 1);
+                advance_begin();
+                throw;
+            }
+        } else {
+            construct(front_slot(), std::move(front()));
+            retreat_begin();
+            auto ans = begin() + ind;
+            for (auto it = begin() + 1; it != ans; ++it) {
+                *it = std::move(*(it + 1));
+            }
+            *ans = std::move(val);
+        }
+        return begin() + ind;
+    }
+
+public:
+    iterator insert(iterator iter, const T& val) {
+        return emplace(iter, val);
+    }
+
+    iterator insert(iterator iter, T&& val) {
+        return emplace(iter, std::move(val));
+    }
+
+    template <std::ranges::input_range R>
+    iterator insert_range(iterator iter, R&& range) {
+        auto ind = iter - begin();
+        if constexpr (std::ranges::forward_range<R> || std::ranges::sized_range<R>) {
+            auto count = static_cast<size_t>(std::ranges::distance(range));
+            if (count == 0) {
+                return iter;
+            }
+            return insert_n(ind, std::ranges::begin(range), count);
+        } else {
+            Deque tmp(get_allocator());
+            tmp.append_range(std::forward<R>(range));
+            return insert_range(begin() + ind, std::ranges::subrange(std::make_move_iterator(tmp.begin()),
+                                                                     std::make_move_iterator(tmp.end())));
+        }
+    }
+
+    template <std::input_iterator InputIt>
+    iterator insert(iterator iter, InputIt first, InputIt last) {
+        return insert_range(iter, std::ranges::subrange(first, last));
+    }
+
+    iterator insert(iterator iter, std::initializer_list<T> list) {
+        return insert_range(iter, list);
+    }
+
+    iterator insert(iterator iter, size_t n, const T& val) {
+        if (n == 0) {
+            return iter;
+        }
+        // val may be an element of the deque that the shift is about to move
+        T copy(val);
+        return insert_n(iter - begin(), ValueRepeater{&copy}, n);
+    }
+
+    iterator erase(iterator first, iterator last) {
+        auto count = static_cast<size_t>(last - first);
+        auto ind = first - begin();
+        if (count == 0) {
+            return first;
+        }
+        if (static_cast<size_t>(ind) < m_size - static_cast<size_t>(ind) - count) {
+            T** old_begin = arr.cur_begin;
+            if constexpr (bitwise_relocatable) {
+                destroy_range(first, last);
+                relocate_backward(begin(), first, last);
+            } else {
+                destroy_range(begin(), std::move_backward(begin(), first, last));
+            }
+            advance_begin(count);
+            arr.release(old_begin, arr.cur_begin);
+            shrink_sparse_map();
+            return begin() + ind;
+        }
+        T** old_end = arr.cur_end;
+        if constexpr (bitwise_relocatable) {
+            destroy_range(first, last);
+            relocate_forward(last, end(), first);
+        } else {
+            destroy_range(std::move(last, end(), first), end());
+        }
+        retreat_end(count);
+        arr.release(arr.cur_end + 1, old_end + 1);
+        shrink_sparse_map();
+        return begin() + ind;
+    }
+
+    iterator erase(iterator iter) {
+        if (iter == begin()) {
+            pop_front();
+            return begin();
+        }
+        auto ind = iter - begin();
+        if (static_cast<size_t>(ind) < m_size - static_cast<size_t>(ind) - 1) {
+            if constexpr (bitwise_relocatable) {
+                destroy(&*iter);
+                relocate_backward(begin(), iter, iter + 1);
+                advance_begin();
+            } else {
+                for (auto it = iter; it != begin(); --it) {
+                    *it = std::move(*(it - 1));
+                }
+                pop_front();
+            }
+            return begin() + ind;
+        }
+        if constexpr (bitwise_relocatable) {
+            destroy(&*iter);
+            relocate_forward(iter + 1, end(), iter);
+            retreat_end();
+        } else {
+            for (auto it = iter; it + 1 != end(); ++it) {
+                *it = std::move(*(it + 1));
+            }
+            pop_back();
+        }
+        // the pop may have reallocated the map under iter
+        return begin() + ind;
+    }
+
+    // removes the elements matching pred in one pass over the chunks,
+    // returns the number of removed elements
+    template <typename Pred>
+    friend size_t erase_if(Deque& deque, Pred pred) {
+        return deque.remove_matching(pred);
+    }
+
+    friend size_t erase(Deque& deque, const T& val) {
+        return erase_if(deque, [&val](const T& item) { return item == val; });
+    }
+
+    ~Deque() {
+        destroy_until(end());
+    }
+
+private:
+    // compacts the kept elements towards the front a chunk at a time, then drops the tail at once
+    template <typename Pred>
+    size_t remove_matching(Pred& pred) {
+        T** src_slot = arr.cur_begin;
+        T* src = m_begin;
+        T** dst_slot = arr.cur_begin;
+        T* dst = m_begin;
+        size_t kept = 0;
+        for (size_t left = m_size; left > 0;) {
+            size_t run = std::min(left, static_cast<size_t>(*src_slot + chunk_size - src));
+            for (T* run_end = src + run; src != run_end; ++src) {
+                if (pred(*src)) {
+                    continue;
+                }
+                if (dst != src) {
+                    *dst = std::move(*src);
+                }
+                ++kept;
+                if (++dst == *dst_slot + chunk_size) {
+                    dst = *++dst_slot;
+                }
+            }
+            left -= run;
+            if (left > 0) {
+                src = *++src_slot;
+            }
+        }
+        size_t removed = m_size - kept;
+        erase(begin() + static_cast<ptrdiff_t>(kept), end());
+        return removed;
+    }
+};
+
+// Random access iterator of containers whose elements are reached by index through operator[].
+// It keeps the container and the index, so it stays valid while the element keeps its index.
+template <typename Container, typename Value>
+class IndexIterator {
+public:
+    using difference_type = ptrdiff_t;
+    using value_type = std::remove_cv_t<Value>;
+    using pointer = Value*;
+    using reference = Value&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    constexpr IndexIterator() = default;
+
+    constexpr IndexIterator(Container* owner, difference_type index) : owner(owner), index(index) {}
+
+    constexpr operator IndexIterator<const Container, const Value>() const {
+        return IndexIterator<const Container, const Value>(owner, index);
+    }
+
+    constexpr reference operator*() const {
+        return (*owner)[static_cast<size_t>(index)];
+    }
+
+    constexpr pointer operator->() const {
+        return &**this;
+    }
+
+    constexpr reference operator[](difference_type diff) const {
+        return (*owner)[static_cast<size_t>(index + diff)];
+    }
+
+    constexpr IndexIterator& operator++() {
+        ++index;
+        return *this;
+    }
+
+    constexpr IndexIterator operator++(int) {
+        auto copy = *this;
+        ++index;
+        return copy;
+    }
+
+    constexpr IndexIterator& operator--() {
+        --index;
+        return *this;
+    }
+
+    constexpr IndexIterator operator--(int) {
+        auto copy = *this;
+        --index;
+        return copy;
+    }
+
+    constexpr IndexIterator& operator+=(difference_type diff) {
+        index += diff;
+        return *this;
+    }
+
+    constexpr IndexIterator& operator-=(difference_type diff) {
+        index -= diff;
+        return *this;
+    }
+
+    constexpr IndexIterator operator+(difference_type diff) const {
+        return IndexIterator(owner, index + diff);
+    }
+
+    constexpr IndexIterator operator-(difference_type diff) const {
+        return IndexIterator(owner, index - diff);
+    }
+
+    constexpr difference_type operator-(const IndexIterator& it) const {
+        return index - it.index;
+    }
+
+    friend constexpr IndexIterator operator+(difference_type diff, const IndexIterator& it) {
+        return it + diff;
+    }
+
+    constexpr bool operator==(const IndexIterator& other) const {
+        return index == other.index;
+    }
+
+    constexpr auto operator<=>(const IndexIterator& other) const {
+        return index <=> other.index;
+    }
+
+private:
+    Container* owner = nullptr;
+    difference_type index = 0;
+};
+
+// Deque with a fixed capacity of N (a power of two) elements that live in a ring inside the object,
+// it never allocates. Pushing into a full deque throws std::length_error. Everything is constexpr,
+// so it can also be used during constant evaluation.
+template <typename T, size_t N>
+class StaticDeque {
+    static_assert(std::has_single_bit(N), "StaticDeque capacity must be a power of two");
+
+public:
+    using value_type = T;
+    using iterator = IndexIterator<StaticDeque, T>;
+    using const_iterator = IndexIterator<const StaticDeque, const T>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+    static constexpr size_t mask = N - 1;
+
+    union Slot {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-member-init)
+        constexpr Slot() {}
+        constexpr ~Slot() {}
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+
+        T value;
+    };
+
+    std::array<Slot, N> ring;
+    size_t head = 0;
+    size_t count = 0;
+
+    constexpr T* slot(size_t ind) {
+        return &ring[(head + ind) & mask].value;
+    }
+
+    constexpr const T* slot(size_t ind) const {
+        return &ring[(head + ind) & mask].value;
+    }
+
+    constexpr void check_room() const {
+        if (count == N) {
+            throw std::length_error("StaticDeque is full");
+        }
+    }
+
+public:
+    constexpr StaticDeque() = default;
+
+    constexpr explicit StaticDeque(size_t n) {
+        resize(n);
+    }
+
+    constexpr StaticDeque(size_t n, const T& val) {
+        resize(n, val);
+    }
+
+    constexpr StaticDeque(const StaticDeque& other) {
+        try {
+            for (const auto& item : other) {
+                emplace_back(item);
+            }
+        } catch (...) {
+            clear();
+            throw;
+        }
+    }
+
+    constexpr StaticDeque(StaticDeque&& other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+        if constexpr (std::is_nothrow_move_constructible_v<T>) {
+            for (auto& item : other) {
+                emplace_back(std::move(item));
+            }
+        } else {
+            try {
+                for (auto& item : other) {
+                    emplace_back(std::move(item));
+                }
+            } catch (...) {
+                clear();
+                throw;
+            }
+        }
+    }
+
+    constexpr StaticDeque& operator=(const StaticDeque& other) {
+        if (this != &other) {
+            clear();
+            for (const auto& item : other) {
+                emplace_back(item);
+            }
+        }
+        return *this;
+    }
+
+    constexpr StaticDeque& operator=(StaticDeque&& other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+        if (this != &other) {
+            clear();
+            for (auto& item : other) {
+                emplace_back(std::move(item));
+            }
+        }
+        return *this;
+    }
+
+    constexpr ~StaticDeque() {
+        clear();
+    }
+
+    constexpr void swap(StaticDeque& other) {
+        StaticDeque tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    constexpr size_t size() const {
+        return count;
+    }
+
+    constexpr bool empty() const {
+        return count == 0;
+    }
+
+    constexpr bool full() const {
+        return count == N;
+    }
+
+    template <typename... Args>
+    constexpr T& emplace_back(Args&&... args) {
+        check_room();
+        T* ptr = std::construct_at(slot(count), std::forward<Args>(args)...);
+        ++count;
+        return *ptr;
+    }
+
+    template <typename... Args>
+    constexpr T& emplace_front(Args&&... args) {
+        check_room();
+        size_t pos = (head - 1) & mask;
+        T* ptr = std::construct_at(&ring[pos].value, std::forward<Args>(args)...);
+        head = pos;
+        ++count;
+        return *ptr;
+    }
+
+    constexpr void push_back(const T& val) {
+        emplace_back(val);
+    }
+
+    constexpr void push_back(T&& val) {
+        emplace_back(std::move(val));
+    }
+
+    constexpr void push_front(const T& val) {
+        emplace_front(val);
+    }
+
+    constexpr void push_front(T&& val) {
+        emplace_front(std::move(val));
+    }
+
+    constexpr void pop_back() {
+        --count;
+        std::destroy_at(slot(count));
+    }
+
+    constexpr void pop_front() {
+        std::destroy_at(slot(0));
+        head = (head + 1) & mask;
+        --count;
+    }
+
+    constexpr T& operator[](size_t ind) {
+        return *slot(ind);
+    }
+
+    constexpr const T& operator[](size_t ind) const {
+        return *slot(ind);
+    }
+
+    constexpr T& at(size_t ind) {
+        if (ind >= count) {
+            throw std::out_of_range("StaticDeque index out of range");
+        }
+        return *slot(ind);
+    }
+
+    constexpr const T& at(size_t ind) const {
+        if (ind >= count) {
+            throw std::out_of_range("StaticDeque index out of range");
+        }
+        return *slot(ind);
+    }
+
+    constexpr T& front() {
+        return *slot(0);
+    }
+
+    constexpr const T& front() const {
+        return *slot(0);
+    }
+
+    constexpr T& back() {
+        return *slot(count - 1);
+    }
+
+    constexpr const T& back() const {
+        return *slot(count - 1);
+    }
+
+    constexpr iterator begin() {
+        return iterator(this, 0);
+    }
+
+    constexpr iterator end() {
+        return iterator(this, static_cast<ptrdiff_t>(count));
+    }
+
+    constexpr const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    constexpr const_iterator end() const {
+        return const_iterator(this, static_cast<ptrdiff_t>(count));
+    }
+
+    constexpr const_iterator cbegin() const {
+        return begin();
+    }
+
+    constexpr const_iterator cend() const {
+        return end();
+    }
+
+    constexpr reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    constexpr reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    constexpr const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    constexpr const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    constexpr const_reverse_iterator crbegin() const {
+        return rbegin();
+    }
+
+    constexpr const_reverse_iterator crend() const {
+        return rend();
+    }
+
+    // builds the element at the back (front) and rotates it into place, moving the shorter side
+    template <typename... Args>
+    constexpr iterator emplace(const_iterator iter, Args&&... args) {
+        auto ind = iter - cbegin();
+        if (static_cast<size_t>(ind) < count - static_cast<size_t>(ind)) {
+            emplace_front(std::forward<Args>(args)...);
+            std::rotate(begin(), begin() + 1, begin() + ind + 1);
+        } else {
+            emplace_back(std::forward<Args>(args)...);
+            std::rotate(begin() + ind, end() - 1, end());
+        }
+        return begin() + ind;
+    }
+
+    constexpr iterator insert(const_iterator iter, const T& val) {
+        return emplace(iter, val);
+    }
+
+    constexpr iterator insert(const_iterator iter, T&& val) {
+        return emplace(iter, std::move(val));
+    }
+
+    constexpr iterator erase(const_iterator first, const_iterator last) {
+        auto ind = first - cbegin();
+        auto erased = last - first;
+        if (ind < cend() - last) {
+            std::move_backward(begin(), begin() + ind, begin() + ind + erased);
+            for (; erased > 0; --erased) {
+                pop_front();
+            }
+        } else {
+            std::move(begin() + ind + erased, end(), begin() + ind);
+            for (; erased > 0; --erased) {
+                pop_back();
+            }
+        }
+        return begin() + ind;
+    }
+
+    constexpr iterator erase(const_iterator iter) {
+        return erase(iter, iter + 1);
+    }
+
+    constexpr void clear() {
+        while (count > 0) {
+            pop_back();
+        }
+        head = 0;
+    }
+
+    constexpr void resize(size_t n) {
+        while (count > n) {
+            pop_back();
+        }
+        while (count < n) {
+            emplace_back();
+        }
+    }
+
+    constexpr void resize(size_t n, const T& val) {
+        while (count > n) {
+            pop_back();
+        }
+        while (count < n) {
+            emplace_back(val);
+        }
+    }
+
+    template <typename Pred>
+    friend constexpr size_t erase_if(StaticDeque& deque, Pred pred) {
+        auto kept = std::remove_if(deque.begin(), deque.end(), pred);
+        auto removed = static_cast<size_t>(deque.end() - kept);
+        deque.erase(kept, deque.end());
+        return removed;
+    }
+
+    friend constexpr size_t erase(StaticDeque& deque, const T& val) {
+        return erase_if(deque, [&val](const T& item) { return item == val; });
+    }
+};
+
+// Deque that keeps its first elements in a StaticDeque of N (rounded up to a power of two) slots
+// inside the object and moves them into a Deque once more are needed; until then it never allocates.
+// The deque stays chunked after that, shrink_to_fit moves a short enough one back into the ring.
+// Iterators hold an index, so any insertion or erasure invalidates them.
+template <typename T, size_t N, typename Allocator = std::allocator<T>, typename Policy = DequePolicy>
+class SmallDeque {
+    static_assert(N > 0, "SmallDeque needs room for at least one element");
+
+public:
+    using value_type = T;
+    using allocator_type = Allocator;
+    using iterator = IndexIterator<SmallDeque, T>;
+    using const_iterator = IndexIterator<const SmallDeque, const T>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    static constexpr size_t inline_capacity = std::bit_ceil(N);
+
+private:
+    StaticDeque<T, inline_capacity> ring;
+    bool spilled = false;
+    Deque<T, Allocator, Policy> heap;
+
+    // moves the ring into chunks with room for extra more elements
+    void spill(size_t extra) {
+        Deque<T, Allocator, Policy> grown(heap.get_allocator());
+        grown.reserve_back(ring.size() + extra);
+        for (auto& item : ring) {
+            grown.emplace_back(std::move_if_noexcept(item));
+        }
+        ring.clear();
+        heap.swap(grown);
+        spilled = true;
+    }
+
+    // moves the elements of a short enough spilled deque back into the ring
+    void unspill() {
+        for (auto& item : heap) {
+            ring.emplace_back(std::move(item));
+        }
+        Deque<T, Allocator, Policy> released(heap.get_allocator());
+        heap.swap(released);
+        spilled = false;
+    }
+
+    // destroys the elements and frees the chunks, the deque is inline afterwards
+    void reset() {
+        if (spilled) {
+            Deque<T, Allocator, Policy> released(heap.get_allocator());
+            heap.swap(released);
+            spilled = false;
+        } else {
+            ring.clear();
+        }
+    }
+
+    // takes over the elements of other into this empty inline deque, other is left empty
+    void take(SmallDeque& other) {
+        if (other.spilled) {
+            heap = std::move(other.heap);
+            spilled = true;
+            other.spilled = false;
+            return;
+        }
+        ring = std::move(other.ring);
+        other.ring.clear();
+    }
+
+public:
+    SmallDeque() noexcept(noexcept(Allocator())) : SmallDeque(Allocator()) {}
+
+    explicit SmallDeque(const Allocator& alloc) noexcept : heap(alloc) {}
+
+    explicit SmallDeque(size_t n, const Allocator& alloc = Allocator()) : heap(alloc) {
+        resize(n);
+    }
+
+    SmallDeque(size_t n, const T& val, const Allocator& alloc = Allocator()) : heap(alloc) {
+        resize(n, val);
+    }
+
+    SmallDeque(const SmallDeque& other) = default;
+
+    // the chunks of a spilled deque go along with its allocator, so only an inline one moves elements
+    SmallDeque(SmallDeque&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+        : spilled(std::exchange(other.spilled, false)), heap(std::move(other.heap)) {
+        if (!spilled) {
+            ring = std::move(other.ring);
+            other.ring.clear();
+        }
+    }
+
+    SmallDeque& operator=(const SmallDeque& other) {
+        if (this != &other) {
+            SmallDeque copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    // with an allocator that neither propagates nor always compares equal, the chunks of a spilled
+    // other may have to be moved element by element into new ones, as in Deque
+    SmallDeque& operator=(SmallDeque&& other) noexcept(
+        std::is_nothrow_move_constructible_v<T> &&
+        (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value ||
+         std::allocator_traits<Allocator>::is_always_equal::value)) {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~SmallDeque() = default;
+
+    void swap(SmallDeque& other) {
+        SmallDeque tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    allocator_type get_allocator() const {
+        return heap.get_allocator();
+    }
+
+    // whether the elements are still stored inside the object
+    bool is_inline() const {
+        return !spilled;
+    }
+
+    size_t size() const {
+        return spilled ? heap.size() : ring.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (!spilled && ring.full()) {
+            T val(std::forward<Args>(args)...);
+            spill(1);
+            return heap.emplace_back(std::move(val));
+        }
+        return spilled ? heap.emplace_back(std::forward<Args>(args)...) : ring.emplace_back(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    T& emplace_front(Args&&... args) {
+        if (!spilled && ring.full()) {
+            T val(std::forward<Args>(args)...);
+            spill(1);
+            return heap.emplace_front(std::move(val));
+        }
+        return spilled ? heap.emplace_front(std::forward<Args>(args)...) : ring.emplace_front(std::forward<Args>(args)...);
+    }
+
+    void push_back(const T& val) {
+        emplace_back(val);
+    }
+
+    void push_back(T&& val) {
+        emplace_back(std::move(val));
+    }
+
+    void push_front(const T& val) {
+        emplace_front(val);
+    }
+
+    void push_front(T&& val) {
+        emplace_front(std::move(val));
+    }
+
+    void pop_back() {
+        spilled ? heap.pop_back() : ring.pop_back();
+    }
+
+    void pop_front() {
+        spilled ? heap.pop_front() : ring.pop_front();
+    }
+
+    T& operator[](size_t ind) {
+        return spilled ? heap[ind] : ring[ind];
+    }
+
+    const T& operator[](size_t ind) const {
+        return spilled ? heap[ind] : ring[ind];
+    }
+
+    T& at(size_t ind) {
+        if (ind >= size()) {
+            throw std::out_of_range("SmallDeque index out of range");
+        }
+        return (*this)[ind];
+    }
+
+    const T& at(size_t ind) const {
+        if (ind >= size()) {
+            throw std::out_of_range("SmallDeque index out of range");
+        }
+        return (*this)[ind];
+    }
+
+    T& front() {
+        return (*this)[0];
+    }
+
+    const T& front() const {
+        return (*this)[0];
+    }
+
+    T& back() {
+        return (*this)[size() - 1];
+    }
+
+    const T& back() const {
+        return (*this)[size() - 1];
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+
+    iterator end() {
+        return iterator(this, static_cast<ptrdiff_t>(size()));
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, static_cast<ptrdiff_t>(size()));
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    const_reverse_iterator crbegin() const {
+        return rbegin();
+    }
+
+    const_reverse_iterator crend() const {
+        return rend();
+    }
+
+    template <typename... Args>
+    iterator emplace(const_iterator iter, Args&&... args) {
+        auto ind = iter - cbegin();
+        if (!spilled && ring.full()) {
+            T val(std::forward<Args>(args)...);
+            spill(1);
+            heap.emplace(heap.begin() + ind, std::move(val));
+        } else if (spilled) {
+            heap.emplace(heap.begin() + ind, std::forward<Args>(args)...);
+        } else {
+            ring.emplace(ring.cbegin() + ind, std::forward<Args>(args)...);
+        }
+        return begin() + ind;
+    }
+
+    iterator insert(const_iterator iter, const T& val) {
+        return emplace(iter, val);
+    }
+
+    iterator insert(const_iterator iter, T&& val) {
+        return emplace(iter, std::move(val));
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        auto ind = first - cbegin();
+        if (spilled) {
+            heap.erase(heap.begin() + ind, heap.begin() + (last - cbegin()));
+        } else {
+            ring.erase(ring.cbegin() + ind, ring.cbegin() + (last - cbegin()));
+        }
+        return begin() + ind;
+    }
+
+    iterator erase(const_iterator iter) {
+        return erase(iter, iter + 1);
+    }
+
+    template <std::ranges::input_range R>
+    void append_range(R&& range) {
+        if (spilled) {
+            heap.append_range(std::forward<R>(range));
+            return;
+        }
+        for (auto&& item : range) {
+            emplace_back(std::forward<decltype(item)>(item));
+        }
+    }
+
+    void clear() {
+        spilled ? heap.clear() : ring.clear();
+    }
+
+    void resize(size_t n) {
+        if (!spilled && n > inline_capacity) {
+            spill(n - ring.size());
+        }
+        spilled ? heap.resize(n) : ring.resize(n);
+    }
+
+    void resize(size_t n, const T& val) {
+        if (!spilled && n > inline_capacity) {
+            spill(n - ring.size());
+        }
+        spilled ? heap.resize(n, val) : ring.resize(n, val);
+    }
+
+    // moves a spilled deque that fits back into the ring (if that cannot throw),
+    // frees the unused chunks otherwise
+    void shrink_to_fit() {
+        if (!spilled) {
+            return;
+        }
+        if (std::is_nothrow_move_constructible_v<T> && heap.size() <= inline_capacity) {
+            unspill();
+        } else {
+            heap.shrink_to_fit();
+        }
+    }
+
+    template <typename Pred>
+    friend size_t erase_if(SmallDeque& deque, Pred pred) {
+        return deque.spilled ? erase_if(deque.heap, pred) : erase_if(deque.ring, pred);
+    }
+
+    friend size_t erase(SmallDeque& deque, const T& val) {
+        return erase_if(deque, [&val](const T& item) { return item == val; });
+    }
+};
+
+template <typename T>
+class RealtimeAllocator;
+
+// Memory of real-time deques, set aside once: `chunks` blocks of chunk_bytes for chunks and `maps`
+// blocks of map_slots slots for maps. They are taken from the global allocator at construction
+// and written to, so that every page is mapped before the deques run; with lock the pages are
+// also mlock'ed to keep them in RAM (std::system_error if that fails or there is no mlock).
+// After that an allocation takes a block off a free list: a request of exactly chunk_bytes gets
+// a chunk block, another one of up to a map block gets a map block, and std::bad_alloc is thrown
+// once the blocks of the kind run out. Like the deques themselves, an arena is not thread safe.
+class RealtimeArena {
+public:
+    // chunks and maps come from separate blocks, whatever their sizes
+    enum class Block { Chunk, Map };
+
+    struct Budget {
+        size_t chunk_bytes = 0;
+        size_t chunks = 0;
+        size_t map_slots = 0;
+        size_t maps = 0;
+        size_t align = alignof(std::max_align_t);
+    };
+
+    // Enough for a RealtimeDeque<T, Policy> of up to `capacity` elements: the chunks they span and
+    // the spare ones at both ends, and two maps (the old and the new one while it grows) of the
+    // largest size pushes make it grow to, since it only grows while it is 1/map_shift_ratio full.
+    template <typename T, typename Policy = RealtimePolicy>
+    static Budget budget_for(size_t capacity) {
+        using Base = BaseDeque<T, RealtimeAllocator<T>, Policy>;
+        static_assert(Policy::map_shift_ratio > 0 && Policy::spare_chunks != SIZE_MAX,
+                      "the storage of the deque has to be bounded by its size");
+        size_t chunks = (capacity + Base::chunk_size - 1) / Base::chunk_size + 1 + 2 * Policy::spare_chunks;
+        return {Base::chunk_bytes, chunks, Policy::map_growth_factor * Policy::map_shift_ratio * chunks + 1, 2,
+                std::max(alignof(T), alignof(std::max_align_t))};
+    }
+
+    explicit RealtimeArena(const Budget& budget, bool lock = false) : budget(budget),
+                                                                      chunk_stride(stride(budget.chunk_bytes)),
+                                                                      map_stride(stride(budget.map_slots * sizeof(void*))),
+                                                                      total(chunk_stride * budget.chunks + map_stride * budget.maps),
+                                                                      region(static_cast<char*>(::operator new(total, std::align_val_t(page_align())))) {
+        std::memset(region, 0, total);
+        if (lock) {
+            lock_region();
+        }
+        for (size_t i = budget.chunks; i > 0; --i) {
+            chunk_list.push(region + (i - 1) * chunk_stride);
+        }
+        char* maps = region + chunk_stride * budget.chunks;
+        for (size_t i = budget.maps; i > 0; --i) {
+            map_list.push(maps + (i - 1) * map_stride);
+        }
+    }
+
+    RealtimeArena(const RealtimeArena&) = delete;
+    RealtimeArena(RealtimeArena&&) = delete;
+    RealtimeArena& operator=(const RealtimeArena&) = delete;
+    RealtimeArena& operator=(RealtimeArena&&) = delete;
+
+    ~RealtimeArena() {
+#if __has_include(<sys/mman.h>)
+        if (locked) {
+            ::munlock(region, total);
+        }
+#endif
+        ::operator delete(region, total, std::align_val_t(page_align()));
+    }
+
+    void* allocate(Block kind, size_t bytes, size_t align) {
+        if (!can_allocate(kind, bytes, align)) {
+            throw std::bad_alloc();
+        }
+        return (kind == Block::Chunk ? chunk_list : map_list).pop();
+    }
+
+    void deallocate(void* block, size_t /*bytes*/) noexcept {
+        auto* ptr = static_cast<char*>(block);
+        (ptr < region + chunk_stride * budget.chunks ? chunk_list : map_list).push(ptr);
+    }
+
+    bool can_allocate(Block kind, size_t bytes, size_t align) const noexcept {
+        if (align > budget.align) {
+            return false;
+        }
+        if (kind == Block::Chunk) {
+            return bytes <= budget.chunk_bytes && chunk_list.head != nullptr;
+        }
+        return bytes <= budget.map_slots * sizeof(void*) && map_list.head != nullptr;
+    }
+
+    size_t free_chunks() const noexcept {
+        return chunk_list.size;
+    }
+
+    size_t free_maps() const noexcept {
+        return map_list.size;
+    }
+
+    bool is_locked() const noexcept {
+        return locked;
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    struct FreeList {
+        Node* head = nullptr;
+        size_t size = 0;
+
+        void push(void* block) {
+            head = ::new (block) Node{head};
+            ++size;
+        }
+
+        void* pop() {
+            Node* node = head;
+            head = node->next;
+            --size;
+            return node;
+        }
+    };
+
+    static constexpr size_t page_bytes = 4096;
+
+    Budget budget;
+    size_t chunk_stride;
+    size_t map_stride;
+    size_t total;
+    char* region;
+    FreeList chunk_list;
+    FreeList map_list;
+    bool locked = false;
+
+    size_t page_align() const {
+        return std::max(budget.align, page_bytes);
+    }
+
+    // a block holds its free list node and keeps the next one aligned
+    size_t stride(size_t bytes) const {
+        bytes = std::max(bytes, sizeof(Node));
+        return (bytes + budget.align - 1) / budget.align * budget.align;
+    }
+
+    void lock_region() {
+#if __has_include(<sys/mman.h>)
+        if (::mlock(region, total) == 0) {
+            locked = true;
+            return;
+        }
+        std::error_code error(errno, std::generic_category());
+#else
+        auto error = std::make_error_code(std::errc::function_not_supported);
+#endif
+        ::operator delete(region, total, std::align_val_t(page_align()));
+        throw std::system_error(error, "RealtimeArena: mlock");
+    }
+};
+
+// Allocator of RealtimeDeque, it takes the chunks and maps from a RealtimeArena. The deque asks it
+// through can_allocate() whether they are left, so that try_push_* fail instead of throwing.
+// The allocator of the deque takes chunks; rebound from RealtimeAllocator<U> to U*, as the deque
+// does for its map, it takes maps.
+template <typename T>
+class RealtimeAllocator {
+public:
+    using value_type = T;
+
+    // implicit like std::pmr::polymorphic_allocator, RealtimeDeque<int> d(&arena) works
+    RealtimeAllocator(RealtimeArena* arena) noexcept : m_arena(arena) {}
+
+    template <typename U>
+    RealtimeAllocator(const RealtimeAllocator<U>& other) noexcept
+        : m_arena(other.arena()),
+          m_kind(std::is_same_v<T, U*> ? RealtimeArena::Block::Map : other.kind()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(m_arena->allocate(m_kind, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        m_arena->deallocate(ptr, n * sizeof(T));
+    }
+
+    bool can_allocate(size_t n) const noexcept {
+        return m_arena->can_allocate(m_kind, n * sizeof(T), alignof(T));
+    }
+
+    RealtimeArena* arena() const noexcept {
+        return m_arena;
+    }
+
+    RealtimeArena::Block kind() const noexcept {
+        return m_kind;
+    }
+
+    template <typename U>
+    bool operator==(const RealtimeAllocator<U>& other) const noexcept {
+        return m_arena == other.arena();
+    }
+
+private:
+    RealtimeArena* m_arena;
+    RealtimeArena::Block m_kind = RealtimeArena::Block::Chunk;
+};
+
+// Deque for latency-critical threads: with the chunks and the map set aside in a RealtimeArena
+// (see RealtimeArena::budget_for) pushes and pops never reach the global allocator nor touch a
+// page for the first time. Past the budget push_* throw std::bad_alloc and try_push_* return false.
+template <typename T, typename Policy = RealtimePolicy>
+using RealtimeDeque = Deque<T, RealtimeAllocator<T>, Policy>;
+
+template <typename It>
+concept SegmentedIterator = requires(It it) { segments(it, it); };
+
+// counterparts of the standard algorithms that run a plain pointer loop over each chunk
+// of a deque instead of stepping a deque iterator, other iterators go to the standard ones
+namespace segmented {
+    template <std::input_iterator It, typename Fn>
+    Fn for_each(It first, It last, Fn fn) {
+        if constexpr (SegmentedIterator<It>) {
+            for (auto segment : segments(first, last)) {
+                for (auto& item : segment) {
+                    fn(item);
+                }
+            }
+            return fn;
+        } else {
+            return std::for_each(first, last, std::move(fn));
+        }
+    }
+
+    template <std::input_iterator It, typename OutputIt>
+    OutputIt copy(It first, It last, OutputIt out) {
+        if constexpr (SegmentedIterator<It>) {
+            for (auto segment : segments(first, last)) {
+                out = std::copy(segment.begin(), segment.end(), out);
+            }
+            return out;
+        } else {
+            return std::copy(first, last, out);
+        }
+    }
+
+    template <std::input_iterator It, typename OutputIt, typename Op>
+    OutputIt transform(It first, It last, OutputIt out, Op op) {
+        if constexpr (SegmentedIterator<It>) {
+            for (auto segment : segments(first, last)) {
+                out = std::transform(segment.begin(), segment.end(), out, op);
+            }
+            return out;
+        } else {
+            return std::transform(first, last, out, op);
+        }
+    }
+
+    template <std::forward_iterator It, typename V>
+    void fill(It first, It last, const V& val) {
+        if constexpr (SegmentedIterator<It>) {
+            for (auto segment : segments(first, last)) {
+                std::fill(segment.begin(), segment.end(), val);
+            }
+        } else {
+            std::fill(first, last, val);
+        }
+    }
+
+    template <std::input_iterator It, typename V>
+    It find(It first, It last, const V& val) {
+        if constexpr (SegmentedIterator<It>) {
+            std::iter_difference_t<It> offset = 0;
+            for (auto segment : segments(first, last)) {
+                auto found = std::find(segment.begin(), segment.end(), val);
+                if (found != segment.end()) {
+                    return first + (offset + (found - segment.begin()));
+                }
+                offset += std::ssize(segment);
+            }
+            return last;
+        } else {
+            return std::find(first, last, val);
+        }
+    }
+
+    template <std::input_iterator It, typename V>
+    std::iter_difference_t<It> count(It first, It last, const V& val) {
+        if constexpr (SegmentedIterator<It>) {
+            std::iter_difference_t<It> result = 0;
+            for (auto segment : segments(first, last)) {
+                result += std::count(segment.begin(), segment.end(), val);
+            }
+            return result;
+        } else {
+            return std::count(first, last, val);
+        }
+    }
+
+    template <std::input_iterator It, typename V, typename BinaryOp = std::plus<>>
+    V accumulate(It first, It last, V init, BinaryOp op = BinaryOp()) {
+        if constexpr (SegmentedIterator<It>) {
+            for (auto segment : segments(first, last)) {
+                init = std::accumulate(segment.begin(), segment.end(), std::move(init), op);
+            }
+            return init;
+        } else {
+            return std::accumulate(first, last, std::move(init), op);
+        }
+    }
+}
+
+// Explicitly vectorized counterparts of a few algorithms for deques of 4 and 8 byte arithmetic
+// values. The kernels use GCC vector extensions over the contiguous memory of each chunk:
+// 16 byte vectors (SSE2 on x86-64) always and 32 byte ones (AVX2) when the CPU reports support
+// at runtime. Other element types and iterators fall back to the segmented and standard versions.
+// sum adds up lanes separately, so for floating point values the rounding differs from a
+// sequential std::accumulate.
+namespace simd {
+    namespace detail {
+        template <typename T>
+        concept Lane = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && (sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t));
+
+        template <typename It>
+        concept Accelerated = SegmentedIterator<It> && Lane<std::iter_value_t<It>>;
+
+        //NOLINTNEXTLINE(readability-magic-numbers)
+        constexpr size_t base_width = 16;
+        //NOLINTNEXTLINE(readability-magic-numbers)
+        constexpr size_t wide_width = 32;
+
+#if defined(__GNUC__)
+        // kernels over one contiguous run, Width is the vector size in bytes; every vector stays local
+        // to a kernel and everything is inlined into the dispatched function so that it is compiled
+        // for the chosen instruction set
+        template <size_t Width, typename T>
+        struct Kernels {
+            typedef T Vec __attribute__((vector_size(Width)));
+            using Mask = decltype(Vec{} == Vec{});
+            static constexpr size_t lanes = Width / sizeof(T);
+
+            [[gnu::always_inline]] static bool any_set(const Mask& mask) {
+                std::array<uint64_t, Width / sizeof(uint64_t)> words{};
+                std::memcpy(words.data(), &mask, Width);
+                uint64_t bits = 0;
+                for (auto word : words) {
+                    bits |= word;
+                }
+                return bits != 0;
+            }
+
+            [[gnu::always_inline]] static size_t find(const T* data, size_t n, T val) {
+                Vec needle = Vec{} + val;
+                size_t pos = 0;
+                for (; pos + lanes <= n; pos += lanes) {
+                    Vec chunk;
+                    std::memcpy(&chunk, data + pos, Width);
+                    if (any_set(chunk == needle)) {
+                        break;
+                    }
+                }
+                while (pos < n && !(data[pos] == val)) {
+                    ++pos;
+                }
+                return pos;
+            }
+
+            [[gnu::always_inline]] static size_t count(const T* data, size_t n, T val) {
+                Vec needle = Vec{} + val;
+                Mask matches{};
+                size_t pos = 0;
+                for (; pos + lanes <= n; pos += lanes) {
+                    Vec chunk;
+                    std::memcpy(&chunk, data + pos, Width);
+                    // a match is -1 in its lane
+                    matches += chunk == needle;
+                }
+                size_t result = 0;
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    result += static_cast<size_t>(-matches[lane]);
+                }
+                for (; pos < n; ++pos) {
+                    result += data[pos] == val ? 1 : 0;
+                }
+                return result;
+            }
+
+            // index of the first smallest (largest) element if it beats best, which is updated; n otherwise
+            template <bool Largest>
+            [[gnu::always_inline]] static size_t extreme(const T* data, size_t n, T& best) {
+                Vec top = Vec{} + best;
+                size_t pos = 0;
+                for (; pos + lanes <= n; pos += lanes) {
+                    Vec chunk;
+                    std::memcpy(&chunk, data + pos, Width);
+                    if constexpr (Largest) {
+                        top = top < chunk ? chunk : top;
+                    } else {
+                        top = chunk < top ? chunk : top;
+                    }
+                }
+                T value = best;
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    value = beats<Largest>(top[lane], value) ? top[lane] : value;
+                }
+                for (; pos < n; ++pos) {
+                    value = beats<Largest>(data[pos], value) ? data[pos] : value;
+                }
+                if (!beats<Largest>(value, best)) {
+                    return n;
+                }
+                best = value;
+                return find(data, n, value);
+            }
+
+            template <bool Largest>
+            [[gnu::always_inline]] static bool beats(T lhs, T rhs) {
+                return Largest ? rhs < lhs : lhs < rhs;
+            }
+
+            [[gnu::always_inline]] static T sum(const T* data, size_t n) {
+                Vec total{};
+                size_t pos = 0;
+                for (; pos + lanes <= n; pos += lanes) {
+                    Vec chunk;
+                    std::memcpy(&chunk, data + pos, Width);
+                    total += chunk;
+                }
+                T result{};
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    result += total[lane];
+                }
+                for (; pos < n; ++pos) {
+                    result += data[pos];
+                }
+                return result;
+            }
+
+            [[gnu::always_inline]] static bool equal(const T* lhs, const T* rhs, size_t n) {
+                size_t pos = 0;
+                for (; pos + lanes <= n; pos += lanes) {
+                    Vec left;
+                    Vec right;
+                    std::memcpy(&left, lhs + pos, Width);
+                    std::memcpy(&right, rhs + pos, Width);
+                    if (any_set(left != right)) {
+                        return false;
+                    }
+                }
+                for (; pos < n; ++pos) {
+                    if (!(lhs[pos] == rhs[pos])) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+#else
+        // compilers without vector extensions get plain loops
+        template <size_t Width, typename T>
+        struct Kernels {
+            static size_t find(const T* data, size_t n, T val) {
+                return static_cast<size_t>(std::find(data, data + n, val) - data);
+            }
+
+            static size_t count(const T* data, size_t n, T val) {
+                return static_cast<size_t>(std::count(data, data + n, val));
+            }
+
+            template <bool Largest>
+            static size_t extreme(const T* data, size_t n, T& best) {
+                size_t found = n;
+                for (size_t i = 0; i < n; ++i) {
+                    if (Largest ? best < data[i] : data[i] < best) {
+                        best = data[i];
+                        found = i;
+                    }
+                }
+                return found;
+            }
+
+            static T sum(const T* data, size_t n) {
+                return std::accumulate(data, data + n, T{});
+            }
+
+            static bool equal(const T* lhs, const T* rhs, size_t n) {
+                return std::equal(lhs, lhs + n, rhs);
+            }
+        };
+#endif
+
+        // walks the chunks of [first, last) and runs the kernels of the given width on each of them
+        template <size_t Width>
+        struct FindOp {
+            template <typename It, typename T>
+            [[gnu::always_inline]] static It run(It first, It last, T val) {
+                std::iter_difference_t<It> offset = 0;
+                for (auto segment : segments(first, last)) {
+                    size_t found = Kernels<Width, T>::find(segment.data(), segment.size(), val);
+                    if (found != segment.size()) {
+                        return first + (offset + static_cast<std::iter_difference_t<It>>(found));
+                    }
+                    offset += std::ssize(segment);
+                }
+                return last;
+            }
+        };
+
+        template <size_t Width>
+        struct CountOp {
+            template <typename It, typename T>
+            [[gnu::always_inline]] static size_t run(It first, It last, T val) {
+                size_t result = 0;
+                for (auto segment : segments(first, last)) {
+                    result += Kernels<Width, T>::count(segment.data(), segment.size(), val);
+                }
+                return result;
+            }
+        };
+
+        template <size_t Width, bool Largest>
+        struct ExtremeOp {
+            template <typename It>
+            [[gnu::always_inline]] static It run(It first, It last) {
+                using T = std::iter_value_t<It>;
+                It result = first;
+                T best = *first;
+                if constexpr (std::is_floating_point_v<T>) {
+                    // nothing compares less or greater than a leading NaN
+                    if (best != best) {
+                        return first;
+                    }
+                }
+                std::iter_difference_t<It> offset = 0;
+                for (auto segment : segments(first, last)) {
+                    size_t found = Kernels<Width, T>::template extreme<Largest>(segment.data(), segment.size(), best);
+                    if (found != segment.size()) {
+                        result = first + (offset + static_cast<std::iter_difference_t<It>>(found));
+                    }
+                    offset += std::ssize(segment);
+                }
+                return result;
+            }
+        };
+
+        template <size_t Width>
+        using MinOp = ExtremeOp<Width, false>;
+
+        template <size_t Width>
+        using MaxOp = ExtremeOp<Width, true>;
+
+        template <size_t Width>
+        struct SumOp {
+            template <typename It>
+            [[gnu::always_inline]] static std::iter_value_t<It> run(It first, It last) {
+                using T = std::iter_value_t<It>;
+                T result{};
+                for (auto segment : segments(first, last)) {
+                    result += Kernels<Width, T>::sum(segment.data(), segment.size());
+                }
+                return result;
+            }
+        };
+
+        template <size_t Width>
+        struct EqualOp {
+            template <typename It1, typename It2>
+            [[gnu::always_inline]] static bool run(It1 first1, It1 last1, It2 first2) {
+                using Run = Kernels<Width, std::iter_value_t<It1>>;
+                std::iter_difference_t<It2> offset = 0;
+                for (auto segment : segments(first1, last1)) {
+                    if constexpr (std::contiguous_iterator<It2>) {
+                        if (!Run::equal(segment.data(), std::to_address(first2) + offset, segment.size())) {
+                            return false;
+                        }
+                    } else {
+                        // the chunks of the two deques need not line up
+                        const auto* lhs = segment.data();
+                        auto from = first2 + offset;
+                        for (auto other : segments(from, from + std::ssize(segment))) {
+                            if (!Run::equal(lhs, other.data(), other.size())) {
+                                return false;
+                            }
+                            lhs += other.size();
+                        }
+                    }
+                    offset += std::ssize(segment);
+                }
+                return true;
+            }
+        };
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        inline bool has_avx2() {
+            static const bool supported = [] {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2") != 0;
+            }();
+            return supported;
+        }
+
+        template <template <size_t> typename Op, typename... Args>
+        [[gnu::target("avx2")]] auto run_wide(Args... args) {
+            return Op<wide_width>::run(args...);
+        }
+#endif
+
+        template <template <size_t> typename Op, typename... Args>
+        auto dispatch(Args... args) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+            if (has_avx2()) {
+                return run_wide<Op>(args...);
+            }
+#endif
+            return Op<base_width>::run(args...);
+        }
+    }
+
+    template <std::input_iterator It, typename V>
+    It find(It first, It last, const V& val) {
+        if constexpr (detail::Accelerated<It> && std::is_same_v<std::iter_value_t<It>, V>) {
+            return detail::dispatch<detail::FindOp>(first, last, val);
+        } else {
+            return segmented::find(first, last, val);
+        }
+    }
+
+    template <std::input_iterator It, typename V>
+    std::iter_difference_t<It> count(It first, It last, const V& val) {
+        if constexpr (detail::Accelerated<It> && std::is_same_v<std::iter_value_t<It>, V>) {
+            return static_cast<std::iter_difference_t<It>>(detail::dispatch<detail::CountOp>(first, last, val));
+        } else {
+            return segmented::count(first, last, val);
+        }
+    }
+
+    template <std::forward_iterator It>
+    It min_element(It first, It last) {
+        if constexpr (detail::Accelerated<It>) {
+            return first == last ? last : detail::dispatch<detail::MinOp>(first, last);
+        } else {
+            return std::min_element(first, last);
+        }
+    }
+
+    template <std::forward_iterator It>
+    It max_element(It first, It last) {
+        if constexpr (detail::Accelerated<It>) {
+            return first == last ? last : detail::dispatch<detail::MaxOp>(first, last);
+        } else {
+            return std::max_element(first, last);
+        }
+    }
+
+    template <std::input_iterator It>
+    std::iter_value_t<It> sum(It first, It last) {
+        if constexpr (detail::Accelerated<It>) {
+            return detail::dispatch<detail::SumOp>(first, last);
+        } else {
+            return segmented::accumulate(first, last, std::iter_value_t<It>{});
+        }
+    }
+
+    template <std::input_iterator It1, std::input_iterator It2>
+    bool equal(It1 first1, It1 last1, It2 first2) {
+        if constexpr (detail::Accelerated<It1> && std::is_same_v<std::iter_value_t<It1>, std::iter_value_t<It2>> &&
+                      (SegmentedIterator<It2> || std::contiguous_iterator<It2>)) {
+            return detail::dispatch<detail::EqualOp>(first1, last1, first2);
+        } else {
+            return std::equal(first1, last1, first2);
+        }
+    }
+}
+
+// A fixed set of worker threads that runs batches of indexed tasks, the calling thread takes part.
+// A task must not start another batch on the same pool.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::max(1U, std::thread::hardware_concurrency())) {
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    // calls task(0), ..., task(count - 1) and waits for all of them, rethrows the first exception
+    void run(size_t count, std::function<void(size_t)> task) {
+        std::lock_guard batch(run_mutex);
+        {
+            std::lock_guard lock(mutex);
+            job = std::move(task);
+            next = 0;
+            total = count;
+            finished = 0;
+            error = nullptr;
+            ++generation;
+        }
+        wake.notify_all();
+        drain();
+        std::unique_lock lock(mutex);
+        done.wait(lock, [this] { return finished == total; });
+        job = nullptr;
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void work() {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+            drain();
+        }
+    }
+
+    void drain() {
+        while (true) {
+            size_t index = 0;
+            {
+                std::lock_guard lock(mutex);
+                if (next == total) {
+                    return;
+                }
+                index = next++;
+            }
+            std::exception_ptr failure;
+            try {
+                job(index);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            std::lock_guard lock(mutex);
+            if (failure && !error) {
+                error = failure;
+            }
+            if (++finished == total) {
+                done.notify_all();
+            }
+        }
+    }
+
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t)> job;
+    size_t next = 0;
+    size_t total = 0;
+    size_t finished = 0;
+    size_t generation = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::vector<std::thread> workers;
+};
+
+// Parallel algorithms that cut the range on chunk boundaries (equal slices for other random access
+// iterators), so every task walks whole chunks with the segmented algorithms and no two tasks
+// share a chunk.
+namespace parallel {
+    namespace detail {
+        // more pieces than threads, so that a slow thread does not hold everyone up
+        //NOLINTNEXTLINE(readability-magic-numbers)
+        constexpr size_t pieces_per_thread = 4;
+
+        // the borders of at most pieces consecutive pieces of [first, last)
+        template <std::random_access_iterator It>
+        std::vector<It> split(It first, It last, size_t pieces) {
+            std::vector<It> borders{first};
+            if constexpr (SegmentedIterator<It>) {
+                auto parts = segments(first, last);
+                auto count = static_cast<size_t>(std::ranges::size(parts));
+                pieces = std::min(pieces, count);
+                auto segment = parts.begin();
+                for (size_t piece = 0; piece < pieces; ++piece) {
+                    std::iter_difference_t<It> length = 0;
+                    for (size_t i = piece * count / pieces; i < (piece + 1) * count / pieces; ++i, ++segment) {
+                        length += std::ssize(*segment);
+                    }
+                    borders.push_back(borders.back() + length);
+                }
+            } else {
+                auto count = static_cast<size_t>(last - first);
+                pieces = std::min(pieces, count);
+                for (size_t piece = 1; piece <= pieces; ++piece) {
+                    borders.push_back(first + static_cast<std::iter_difference_t<It>>(piece * count / pieces));
+                }
+            }
+            return borders;
+        }
+
+        template <std::random_access_iterator It>
+        std::vector<It> split(It first, It last, const ThreadPool& pool) {
+            return split(first, last, pool.size() * pieces_per_thread);
+        }
+
+        template <std::random_access_iterator It>
+        It shifted(It iter, size_t count) {
+            return iter + static_cast<std::iter_difference_t<It>>(count);
+        }
+
+        // how many elements of a are among the first `rank` elements of the stable merge of a and b
+        template <std::ranges::random_access_range A, std::ranges::random_access_range B, typename Compare>
+        size_t co_rank(const A& a_run, const B& b_run, size_t rank, Compare& comp) {
+            auto b_size = static_cast<size_t>(std::ranges::size(b_run));
+            size_t low = rank > b_size ? rank - b_size : 0;
+            size_t high = std::min(rank, static_cast<size_t>(std::ranges::size(a_run)));
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (comp(*shifted(b_run.begin(), rank - middle - 1), *shifted(a_run.begin(), middle))) {
+                    high = middle;
+                } else {
+                    low = middle + 1;
+                }
+            }
+            return low;
+        }
+
+        // A slice [begin, end) of the output of a merge round and how many elements of the first run
+        // of their pair precede begin (end) in the merged pair, if it lies within a pair.
+        struct Slice {
+            size_t begin = 0;
+            size_t end = 0;
+            size_t a_begin = 0;
+            size_t a_end = 0;
+        };
+
+        // the co-rank of position `pos` of the output within the pair of runs of `from` it lies in
+        template <typename From, typename Compare>
+        size_t rank_at(From from, const std::vector<size_t>& runs, size_t pos, Compare& comp) {
+            for (size_t left = 0; left + 1 < runs.size(); left += 2) {
+                size_t stop = runs[std::min(left + 2, runs.size() - 1)];
+                if (pos < stop) {
+                    std::ranges::subrange a_run(shifted(from, runs[left]), shifted(from, runs[left + 1]));
+                    std::ranges::subrange b_run(shifted(from, runs[left + 1]), shifted(from, stop));
+                    return co_rank(a_run, b_run, pos - runs[left], comp);
+                }
+            }
+            return 0;
+        }
+
+        // Moves the elements of a slice of the merged pairs of neighbouring runs of `from` to the
+        // same positions of `to`. runs holds the run borders, an unpaired last run is just moved.
+        template <typename From, typename To, typename Compare>
+        void merge_slice(From from, To to, const std::vector<size_t>& runs, const Slice& slice, Compare& comp) {
+            for (size_t left = 0; left + 1 < runs.size(); left += 2) {
+                size_t start = runs[left];
+                size_t split = runs[left + 1];
+                size_t stop = runs[std::min(left + 2, runs.size() - 1)];
+                size_t low = std::max(slice.begin, start);
+                size_t high = std::min(slice.end, stop);
+                if (low >= high) {
+                    continue;
+                }
+                size_t a_low = low > start ? slice.a_begin : 0;
+                size_t a_high = high < stop ? slice.a_end : split - start;
+                std::merge(std::make_move_iterator(shifted(from, start + a_low)),
+                           std::make_move_iterator(shifted(from, start + a_high)),
+                           std::make_move_iterator(shifted(from, split + (low - start - a_low))),
+                           std::make_move_iterator(shifted(from, split + (high - start - a_high))),
+                           shifted(to, low), comp);
+            }
+        }
+
+        // Merges the sorted runs of [first, first + size) pairwise until one is left, moving the
+        // elements back and forth between the range and a buffer. Every round cuts the output into
+        // equal slices and finds where each slice starts in its two runs by binary search, so all
+        // threads take part up to the last merge. The merges move elements out of the runs, so all
+        // the searches of a round are done before.
+        template <std::random_access_iterator It, typename Compare>
+        void merge_runs(It first, size_t size, std::vector<size_t> runs, Compare& comp, ThreadPool& pool) {
+            auto buffer = std::make_unique_for_overwrite<std::iter_value_t<It>[]>(size);
+            size_t slices = std::min(size, pool.size() * pieces_per_thread);
+            std::vector<size_t> ranks(slices + 1);
+            bool in_buffer = false;
+            while (runs.size() > 2) {
+                pool.run(slices + 1, [&](size_t border) {
+                    size_t pos = border * size / slices;
+                    ranks[border] = in_buffer ? rank_at(buffer.get(), runs, pos, comp) : rank_at(first, runs, pos, comp);
+                });
+                pool.run(slices, [&](size_t slice) {
+                    Slice part{slice * size / slices, (slice + 1) * size / slices, ranks[slice], ranks[slice + 1]};
+                    in_buffer ? merge_slice(buffer.get(), first, runs, part, comp)
+                              : merge_slice(first, buffer.get(), runs, part, comp);
+                });
+                std::vector<size_t> merged;
+                for (size_t border = 0; border < runs.size(); border += 2) {
+                    merged.push_back(runs[border]);
+                }
+                // with an odd number of runs the last one is carried over unpaired
+                if (runs.size() % 2 == 0) {
+                    merged.push_back(size);
+                }
+                runs = std::move(merged);
+                in_buffer = !in_buffer;
+            }
+            if (in_buffer) {
+                pool.run(slices, [&](size_t slice) {
+                    size_t begin = slice * size / slices;
+                    size_t end = (slice + 1) * size / slices;
+                    std::move(buffer.get() + begin, buffer.get() + end, shifted(first, begin));
+                });
+            }
+        }
+    }
+
+    template <std::random_access_iterator It, typename Fn>
+    void for_each(It first, It last, Fn fn, ThreadPool& pool = ThreadPool::shared()) {
+        auto borders = detail::split(first, last, pool);
+        pool.run(borders.size() - 1, [&](size_t piece) {
+            segmented::for_each(borders[piece], borders[piece + 1], fn);
+        });
+    }
+
+    template <std::random_access_iterator It, std::random_access_iterator OutputIt, typename Op>
+    OutputIt transform(It first, It last, OutputIt out, Op op, ThreadPool& pool = ThreadPool::shared()) {
+        auto borders = detail::split(first, last, pool);
+        pool.run(borders.size() - 1, [&](size_t piece) {
+            segmented::transform(borders[piece], borders[piece + 1], out + (borders[piece] - first), op);
+        });
+        return out + (last - first);
+    }
+
+    // op must be associative, the partial results are combined in order
+    template <std::random_access_iterator It, typename V, typename BinaryOp = std::plus<>>
+    V reduce(It first, It last, V init, BinaryOp op = BinaryOp(), ThreadPool& pool = ThreadPool::shared()) {
+        auto borders = detail::split(first, last, pool);
+        std::vector<std::optional<V>> partial(borders.size() - 1);
+        pool.run(partial.size(), [&](size_t piece) {
+            partial[piece] = segmented::accumulate(borders[piece] + 1, borders[piece + 1], V(*borders[piece]), op);
+        });
+        for (auto& value : partial) {
+            init = op(std::move(init), std::move(*value));
+        }
+        return init;
+    }
+
+    // Sorts the pieces in parallel, then merges neighbours pairwise, halving the count every round.
+    // Element types that cannot be default-initialized into a merge buffer are merged in place,
+    // one pair per task.
+    template <std::random_access_iterator It, typename Compare = std::less<>>
+    void sort(It first, It last, Compare comp = Compare(), ThreadPool& pool = ThreadPool::shared()) {
+        auto borders = detail::split(first, last, pool);
+        size_t pieces = borders.size() - 1;
+        pool.run(pieces, [&](size_t piece) {
+            std::sort(borders[piece], borders[piece + 1], comp);
+        });
+        if constexpr (std::default_initializable<std::iter_value_t<It>>) {
+            if (pieces > 1) {
+                std::vector<size_t> runs;
+                for (auto border : borders) {
+                    runs.push_back(static_cast<size_t>(border - first));
+                }
+                detail::merge_runs(first, static_cast<size_t>(last - first), std::move(runs), comp, pool);
+            }
+        } else {
+            for (size_t width = 1; width < pieces; width *= 2) {
+                pool.run((pieces + 2 * width - 1) / (2 * width), [&](size_t pair) {
+                    size_t from = 2 * width * pair;
+                    size_t middle = std::min(from + width, pieces);
+                    size_t to = std::min(from + 2 * width, pieces);
+                    std::inplace_merge(borders[from], borders[middle], borders[to], comp);
+                });
+            }
+        }
+    }
+}
+
+namespace pmr {
+    template <typename T, typename Policy = DequePolicy>
+    using Deque = ::Deque<T, std::pmr::polymorphic_allocator<T>, Policy>;
+
+    template <typename T, size_t N, typename Policy = DequePolicy>
+    using SmallDeque = ::SmallDeque<T, N, std::pmr::polymorphic_allocator<T>, Policy>;
+}
 
 
 #endif //PROJECT_DEQUE_H
@@ -7,6 +7,21 @@
 #include <vector>
 #include <iterator>
 #include <random>
+#include <list>
+#include <sstream>
+#include <memory_resource>
+#include <array>
+#include <string>
+#include <span>
+#include <numeric>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <limits>
+#include <stdexcept>
+#include <set>
+#include <thread>
+#include <system_error>
 
 using testing::make_test;
 using testing::PrettyTest;
@@ -89,6 +104,49 @@ struct NotDefaultConstructible {
     auto operator<=>(const NotDefaultConstructible&) const = default;
 };
 
+struct CopyCounted {
+    inline static int copies = 0;
+
+    explicit CopyCounted(int data): data(data) {}
+    CopyCounted(const CopyCounted& other): data(other.data) { ++copies; }
+    CopyCounted(CopyCounted&&) noexcept = default;
+    CopyCounted& operator=(const CopyCounted& other) {
+        data = other.data;
+        ++copies;
+        return *this;
+    }
+    CopyCounted& operator=(CopyCounted&&) noexcept = default;
+    ~CopyCounted() = default;
+
+    int data;
+};
+
+struct MoveCounted {
+    inline static int moves = 0;
+
+    explicit MoveCounted(int data): data(data) {}
+    MoveCounted(const MoveCounted&) = default;
+    MoveCounted(MoveCounted&& other) noexcept: data(other.data) { ++moves; }
+    MoveCounted& operator=(const MoveCounted&) = default;
+    MoveCounted& operator=(MoveCounted&& other) noexcept {
+        data = other.data;
+        ++moves;
+        return *this;
+    }
+    ~MoveCounted() = default;
+
+    int data;
+};
+
+struct Relocatable {
+    explicit Relocatable(int data): data(std::make_unique<int>(data)) {}
+
+    std::unique_ptr<int> data;
+};
+
+template<>
+struct TriviallyRelocatable<Relocatable> : std::true_type {};
+
 struct CountedException : public std::exception { };
 
 template<int ThrowCounter>
@@ -110,6 +168,224 @@ struct Counted {
     }
 };
 
+struct AllocationStats {
+    inline static long long allocated = 0;
+    inline static long long live_blocks = 0;
+};
+
+// Counts the calls of the global operator new made by this thread while it is alive
+struct AllocationTrap {
+    inline static thread_local bool armed = false;
+    inline static thread_local long long caught = 0;
+
+    AllocationTrap() {
+        armed = true;
+        caught = 0;
+    }
+
+    AllocationTrap(const AllocationTrap&) = delete;
+    AllocationTrap(AllocationTrap&&) = delete;
+    AllocationTrap& operator=(const AllocationTrap&) = delete;
+    AllocationTrap& operator=(AllocationTrap&&) = delete;
+
+    ~AllocationTrap() {
+        armed = false;
+    }
+
+    long long allocations() const {
+        return caught;
+    }
+
+    static void* allocate(size_t size, size_t alignment) noexcept {
+        caught += armed ? 1 : 0;
+        size = std::max<size_t>(size, 1);
+        if (alignment <= alignof(std::max_align_t)) {
+            return std::malloc(size);
+        }
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+
+    static void* allocate_or_throw(size_t size, size_t alignment) {
+        if (void* ptr = allocate(size, alignment)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+};
+
+// Every form of the global operator new and delete is replaced, so that all of them go through
+// malloc and free and no allocation made by one allocator is released by another
+void* operator new(size_t size) {
+    return AllocationTrap::allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size) {
+    return AllocationTrap::allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    return AllocationTrap::allocate_or_throw(size, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    return AllocationTrap::allocate_or_throw(size, static_cast<size_t>(align));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return AllocationTrap::allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return AllocationTrap::allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return AllocationTrap::allocate(size, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return AllocationTrap::allocate(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        AllocationStats::allocated += static_cast<long long>(n * sizeof(T));
+        ++AllocationStats::live_blocks;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        --AllocationStats::live_blocks;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U>&) const {
+        return true;
+    }
+};
+
+struct SingleElementChunks : DequePolicy {
+    static constexpr size_t chunk_bytes = 1;
+};
+
+struct SmallPool : DequePolicy {
+    static constexpr size_t chunk_bytes = 64 * sizeof(int);
+    static constexpr size_t pool_thread_chunks = 4;
+    static constexpr size_t pool_shared_chunks = 6;
+};
+
+struct NoPool : DequePolicy {
+    static constexpr size_t pool_thread_chunks = 0;
+};
+
+struct NoSpareChunks : DequePolicy {
+    static constexpr size_t chunk_bytes = 1;
+    static constexpr size_t spare_chunks = 0;
+};
+
+struct KeepAllChunks : DequePolicy {
+    static constexpr size_t chunk_bytes = 1;
+    static constexpr size_t spare_chunks = SIZE_MAX;
+    static constexpr size_t map_shrink_ratio = 0;
+};
+
+struct ShrinkingMap : DequePolicy {
+    static constexpr size_t chunk_bytes = 1;
+    static constexpr size_t map_shrink_ratio = 8;
+};
+
+struct IncrementalMap : DequePolicy {
+    static constexpr size_t chunk_bytes = 1;
+    static constexpr bool incremental_map = true;
+};
+
+struct TinyBackGrowth : BackGrowthPolicy {
+    static constexpr size_t chunk_bytes = 1;
+};
+
+struct TinyFrontGrowth : FrontGrowthPolicy {
+    static constexpr size_t chunk_bytes = 1;
+    static constexpr bool incremental_map = true;
+};
+
+struct MappedTinyChunks : DequePolicy {
+    static constexpr size_t chunk_bytes = sizeof(int);
+    static constexpr bool mapped_chunks = true;
+};
+
+struct TinyQueue : QueuePolicy {
+    static constexpr size_t chunk_bytes = 1;
+};
+
+struct MappedChunkPolicy : DequePolicy {
+    static constexpr bool mapped_chunks = true;
+};
+
+struct OddChunks : DequePolicy {
+    static constexpr size_t chunk_bytes = 3 * sizeof(int);
+};
+
+struct Large {
+    std::array<char, 4096> payload{};
+};
+
 template<typename iter, typename T>
 struct CheckIter{
     using traits = std::iterator_traits<iter>;
@@ -135,6 +411,43 @@ struct CheckIter{
     static_assert(std::is_same_v<decltype(std::declval<iter>() != std::declval<iter>()), bool>);
 };
 
+// runs random pushes, pops, inserts and erases on deque and std::deque side by side,
+// the size drifts between a third of max_size and max_size
+template<typename Test, typename Container>
+void check_against_std_deque(Test& test, Container deque, size_t max_size) {
+    std::deque<int> expected;
+    std::mt19937 gen(31);
+    for (int i = 0; i < 5000; ++i) {
+        auto action = gen() % 7;
+        bool grow = expected.size() < max_size / 3 || (expected.size() < max_size && gen() % 2 == 0);
+        if (!grow && action < 4) {
+            action % 2 ? (deque.pop_back(), expected.pop_back()) : (deque.pop_front(), expected.pop_front());
+        } else if (!grow) {
+            auto pos = static_cast<ptrdiff_t>(gen() % expected.size());
+            deque.erase(deque.begin() + pos);
+            expected.erase(expected.begin() + pos);
+        } else if (action < 3) {
+            deque.push_back(i);
+            expected.push_back(i);
+        } else if (action < 5) {
+            deque.push_front(i);
+            expected.push_front(i);
+        } else {
+            auto pos = static_cast<ptrdiff_t>(gen() % (expected.size() + 1));
+            deque.insert(deque.begin() + pos, i);
+            expected.insert(expected.begin() + pos, i);
+        }
+        if constexpr (requires { deque.shrink_to_fit(); }) {
+            if (i % 500 == 0) {
+                deque.shrink_to_fit();
+            }
+        }
+    }
+    test.equals(deque.size(), expected.size());
+    test.check(std::equal(deque.begin(), deque.end(), expected.begin(), expected.end()));
+    test.check(std::equal(deque.rbegin(), deque.rend(), expected.rbegin(), expected.rend()));
+}
+
 TestGroup create_constructor_tests() {
     return { "constructors",
         make_test<PrettyTest>("default", [](auto& test){
@@ -160,6 +473,28 @@ TestGroup create_constructor_tests() {
             test.check(std::equal(copy.begin(), copy.end(), without_default.begin()));
         }),
 
+        make_test<PrettyTest>("copy of unaligned chunks", [](auto& test) {
+            Deque<int> source;
+            Deque<std::string> strings;
+            for (int i = 0; i < 1000; ++i) {
+                source.push_back(i);
+                source.push_front(-i);
+                strings.push_front(std::to_string(i));
+            }
+            for (int i = 0; i < 37; ++i) {
+                source.pop_front();
+                strings.pop_back();
+            }
+            Deque<int> copy = source;
+            test.equals(copy.size(), source.size());
+            test.check(std::equal(copy.begin(), copy.end(), source.begin()));
+            Deque<std::string> strings_copy(strings);
+            test.check(std::equal(strings_copy.begin(), strings_copy.end(), strings.begin(), strings.end()));
+
+            Deque<char> bytes(1000, 'z');
+            test.equals(std::count(bytes.begin(), bytes.end(), 'z'), 1000);
+        }),
+
         make_test<PrettyTest>("with size", [](auto& test){
             size_t size = 17;
             int value = 14;
@@ -182,6 +517,42 @@ TestGroup create_constructor_tests() {
             test.check((first.size() == second.size()) && (first.size() == 9) && std::equal(first.begin(), first.end(), second.begin()));
         }),
 
+        make_test<PrettyTest>("move", [](auto& test){
+            Deque<int, CountingAllocator<int>> source(1000, 5);
+            auto blocks = AllocationStats::live_blocks;
+            Deque<int, CountingAllocator<int>> moved = std::move(source);
+            test.equals(AllocationStats::live_blocks, blocks);
+            test.equals(moved.size(), size_t(1000));
+            test.check(source.empty());
+            test.equals(source.end() - source.begin(), 0);
+
+            source.push_back(1);
+            source.push_front(0);
+            test.equals(source.size(), size_t(2));
+            test.equals(source[1], 1);
+
+            source = std::move(moved);
+            test.equals(source.size(), size_t(1000));
+            test.check(moved.empty());
+            test.check(std::all_of(source.begin(), source.end(), [](int item) { return item == 5; }));
+
+            CopyCounted::copies = 0;
+            std::vector<Deque<CopyCounted>> deques;
+            for (int i = 0; i < 100; ++i) {
+                deques.emplace_back(size_t(100), CopyCounted(i));
+            }
+            test.equals(CopyCounted::copies, 100 * 100);
+            test.equals(deques[99][99].data, 99);
+
+            std::pmr::monotonic_buffer_resource first_arena;
+            std::pmr::monotonic_buffer_resource second_arena;
+            pmr::Deque<int> first(10, 1, &first_arena);
+            pmr::Deque<int> second(&second_arena);
+            second = std::move(first);
+            test.check(second.get_allocator().resource() == &second_arena);
+            test.equals(second.size(), size_t(10));
+        }),
+
         make_test<SimpleTest>("static asserts", []{
             using T1 = int;
             using T2 = NotDefaultConstructible;
@@ -198,6 +569,9 @@ TestGroup create_constructor_tests() {
             static_assert(std::is_copy_assignable_v<Deque<T1>>, "should have assignment operator");
             static_assert(std::is_copy_assignable_v<Deque<T2>>, "should have assignment operator");
 
+            static_assert(std::is_nothrow_move_constructible_v<Deque<T1>>, "should have noexcept move constructor");
+            static_assert(std::is_nothrow_move_assignable_v<Deque<T2>>, "should have noexcept move assignment");
+
             return true;       
         })
     };
@@ -260,6 +634,10 @@ TestGroup create_iterator_tests() {
                     decltype(std::declval<Deque<int>>().begin()) 
                     >, "should NOT be able to construct iterator from const iterator");
 
+            static_assert(std::random_access_iterator<Deque<int>::iterator>);
+            static_assert(std::random_access_iterator<Deque<int>::const_iterator>);
+            static_assert(std::ranges::random_access_range<Deque<int>>);
+
             return true;
         }),
         make_test<PrettyTest>("arithmetic", [](auto& test){
@@ -308,6 +686,102 @@ TestGroup create_iterator_tests() {
             //std::copy(d.begin(), d.end(), std::ostream_iterator<int>(std::cout, " "));
             //std::cout << std::endl;
             test.equals(sorted_border - d.begin(), 500);
+        }),
+        make_test<PrettyTest>("segments", [](auto& test){
+            Deque<int> empty;
+            test.check(std::ranges::empty(empty.segments()));
+
+            Deque<int, std::allocator<int>, OddChunks> d;
+            for (int i = 0; i < 10; ++i) {
+                d.push_back(i);
+            }
+            d.push_front(-1);
+            std::vector<size_t> sizes;
+            std::vector<int> items;
+            d.for_each_segment([&](std::span<int> segment) {
+                sizes.push_back(segment.size());
+                items.insert(items.end(), segment.begin(), segment.end());
+            });
+            test.check(sizes == std::vector<size_t>{1, 2, 2, 2, 2, 2});
+            test.check(std::ranges::equal(items, d));
+
+            size_t total = 0;
+            for (auto segment : segments(d.cbegin() + 2, d.cend() - 2)) {
+                static_assert(std::is_same_v<decltype(segment), std::span<const int>>);
+                total += segment.size();
+            }
+            test.equals(total, size_t(7));
+            test.check(std::ranges::empty(segments(d.begin() + 3, d.begin() + 3)));
+        }),
+        make_test<PrettyTest>("segmented algorithms", [](auto& test){
+            Deque<int, std::allocator<int>, OddChunks> d(100, 0);
+            std::iota(d.begin(), d.end(), 0);
+            std::vector<int> copy;
+            segmented::copy(d.begin() + 5, d.end(), std::back_inserter(copy));
+            test.equals(copy.size(), size_t(95));
+            test.check(std::equal(copy.begin(), copy.end(), d.begin() + 5));
+
+            test.equals(segmented::accumulate(d.cbegin(), d.cend(), 0L), 4950L);
+            test.equals(segmented::accumulate(copy.begin(), copy.end(), 0), 4940);
+            test.check(segmented::find(d.begin(), d.end(), 57) == d.begin() + 57);
+            test.check(segmented::find(d.begin() + 60, d.end(), 57) == d.end());
+            test.check(segmented::find(d.begin(), d.begin(), 0) == d.begin());
+
+            segmented::fill(d.begin() + 10, d.begin() + 20, -1);
+            test.equals(segmented::count(d.begin(), d.end(), -1), 10);
+            test.equals(d[9], 9);
+            test.equals(d[20], 20);
+
+            int calls = 0;
+            segmented::for_each(d.begin(), d.end(), [&calls](int& item) { item = calls++; });
+            test.equals(calls, 100);
+            test.equals(d[99], 99);
+        }),
+        make_test<PrettyTest>("simd algorithms", [](auto& test){
+            auto check_against_std = [&test](auto deque) {
+                using Value = typename decltype(deque)::value_type;
+                std::mt19937 gen(1729);
+                for (int i = 0; i < 3000; ++i) {
+                    deque.push_back(static_cast<Value>(gen() % 1000));
+                }
+                deque.push_front(static_cast<Value>(1));
+                std::vector<Value> vec(deque.begin(), deque.end());
+                for (auto first = deque.begin(); first < deque.end(); first += 331) {
+                    auto last = first + std::min<ptrdiff_t>(1500, deque.end() - first);
+                    auto offset = first - deque.begin();
+                    auto vec_first = vec.begin() + offset;
+                    test.equals(simd::find(first, last, Value(7)) - first,
+                                std::find(vec_first, vec_first + (last - first), Value(7)) - vec_first);
+                    test.equals(simd::count(first, last, Value(7)), std::count(first, last, Value(7)));
+                    test.check(simd::min_element(first, last) == std::min_element(first, last));
+                    test.check(simd::max_element(first, last) == std::max_element(first, last));
+                    test.check(simd::sum(first, last) == std::accumulate(first, last, Value(0)));
+                    test.check(simd::equal(first, last, vec_first));
+                }
+                test.check(simd::find(deque.begin(), deque.end(), Value(1000)) == deque.end());
+                test.check(simd::min_element(deque.end(), deque.end()) == deque.end());
+
+                auto other = deque;
+                other.pop_front();
+                other.push_front(Value(1));
+                test.check(simd::equal(deque.cbegin(), deque.cend(), other.cbegin()));
+                other[2500] = Value(1001);
+                test.check(!simd::equal(deque.cbegin(), deque.cend(), other.cbegin()));
+            };
+            check_against_std(Deque<int64_t>());
+            check_against_std(Deque<uint32_t>());
+            check_against_std(Deque<float, std::allocator<float>, OddChunks>());
+            check_against_std(Deque<double>());
+            check_against_std(Deque<short>());
+
+            Deque<float> nans(100, 1.0F);
+            nans[50] = std::numeric_limits<float>::quiet_NaN();
+            nans[70] = -1.0F;
+            test.check(simd::min_element(nans.begin(), nans.end()) == std::min_element(nans.begin(), nans.end()));
+            test.check(simd::max_element(nans.begin(), nans.end()) == std::max_element(nans.begin(), nans.end()));
+            test.check(!simd::equal(nans.begin(), nans.end(), nans.begin()));
+            nans[0] = std::numeric_limits<float>::quiet_NaN();
+            test.check(simd::min_element(nans.begin(), nans.end()) == nans.begin());
         })
     };
 }
@@ -403,6 +877,368 @@ TestGroup create_modification_tests() {
             test.equals(d.size(), copy.size());
             test.check(std::equal(d.begin(), d.end(), copy.begin()));
         }),
+        make_test<PrettyTest>("erase returns a valid iterator", [](auto& test){
+            // erasing near the back pops the back, which shrinks the map of ShrinkingMap
+            Deque<std::string, std::allocator<std::string>, ShrinkingMap> d;
+            for (int i = 0; i < 1000; ++i) {
+                d.push_back(std::to_string(i));
+            }
+            while (d.size() > 1) {
+                auto it = d.erase(d.end() - 2);
+                test.equals(it - d.begin(), static_cast<ptrdiff_t>(d.size()) - 1);
+                test.equals(*it, std::string("999"));
+            }
+
+            Deque<std::string> strings(100, "a");
+            auto it = strings.erase(strings.end() - 2);
+            test.check(it + 1 == strings.end());
+            test.equals(*it, std::string("a"));
+        }),
+        make_test<PrettyTest>("emplace and move", [](auto& test){
+            Deque<std::unique_ptr<int>> d;
+            for (int i = 0; i < 100; ++i) {
+                d.emplace_back(std::make_unique<int>(i));
+                d.push_front(std::make_unique<int>(-i));
+            }
+            test.equals(*d.emplace_back(new int(1000)), 1000);
+            test.equals(*d.emplace_front(new int(-1000)), -1000);
+            auto it = d.emplace(d.begin() + 101, new int(500));
+            test.equals(**it, 500);
+            test.equals(*d[100], 0);
+            test.equals(*d[103], 1);
+            d.insert(d.begin() + 1, std::make_unique<int>(7));
+            d.erase(d.begin() + 1);
+            test.equals(d.size(), size_t(203));
+            test.equals(*d.front(), -1000);
+            test.equals(*d.back(), 1000);
+
+            CopyCounted::copies = 0;
+            Deque<CopyCounted> counted;
+            for (int i = 0; i < 100; ++i) {
+                counted.push_back(CopyCounted(i));
+                counted.emplace_front(i);
+            }
+            counted.insert(counted.begin() + 50, CopyCounted(1));
+            counted.emplace(counted.begin() + 70, 2);
+            counted.erase(counted.begin() + 30);
+            test.equals(CopyCounted::copies, 0);
+            test.equals(counted.size(), size_t(201));
+        }),
+
+        make_test<PrettyTest>("bulk append and prepend", [](auto& test){
+            std::vector<int> source(1000);
+            std::iota(source.begin(), source.end(), 0);
+
+            Deque<int> d;
+            d.append_range(source);
+            d.prepend_range(std::vector<int>{-3, -2, -1});
+            d.append_range(std::list<int>{1000, 1001});
+            test.equals(d.size(), size_t(1005));
+            test.equals(d.front(), -3);
+            test.equals(d.back(), 1001);
+            test.check(std::is_sorted(d.begin(), d.end()));
+
+            for (int i = 0; i < 10; ++i) {
+                d.pop_front();
+            }
+            d.prepend_range(source);
+            test.equals(d.size(), size_t(1995));
+            test.check(std::equal(source.begin(), source.end(), d.begin()));
+            test.equals(d[1000], 7);
+
+            std::istringstream input("1 2 3");
+            Deque<int> from_stream(1, 0);
+            from_stream.prepend_range(std::ranges::subrange(std::istream_iterator<int>(input), std::istream_iterator<int>()));
+            test.equals(from_stream.size(), size_t(4));
+            test.equals(from_stream.front(), 1);
+
+            Deque<std::string> strings(2, "x");
+            strings.prepend_range(std::list<std::string>{"a", "b"});
+            strings.append_range(Deque<std::string>(strings));
+            test.equals(strings.size(), size_t(8));
+            test.equals(strings[4], std::string("a"));
+
+            d.assign({1, 2, 3});
+            test.equals(d.size(), size_t(3));
+            test.equals(d[2], 3);
+            d.assign(size_t(2000), 5);
+            test.equals(d.size(), size_t(2000));
+            test.equals(std::count(d.begin(), d.end(), 5), 2000);
+            d.assign(source.rbegin(), source.rend());
+            test.equals(d.front(), 999);
+        }),
+
+        make_test<PrettyTest>("resize and clear", [](auto& test){
+            Deque<int> d(5, 7);
+            d.resize(1000);
+            test.equals(d.size(), size_t(1000));
+            test.equals(d[4], 7);
+            test.equals(std::count(d.begin(), d.end(), 0), 995);
+            d.resize(3);
+            test.equals(d.size(), size_t(3));
+            test.equals(d.back(), 7);
+            d.resize(300, d.front());
+            test.equals(std::count(d.begin(), d.end(), 7), 300);
+
+            d.resize_front(500);
+            test.equals(d.size(), size_t(500));
+            test.equals(d.front(), 0);
+            test.equals(d[199], 0);
+            test.equals(d[200], 7);
+            d.resize_front(100);
+            test.equals(d.size(), size_t(100));
+            test.equals(std::count(d.begin(), d.end(), 7), 100);
+
+            d.resize_for_overwrite(1 << 12);
+            test.equals(d.size(), size_t(1 << 12));
+            std::iota(d.begin() + 100, d.end(), 100);
+            test.equals(d.back(), (1 << 12) - 1);
+            test.equals(d.end() - d.begin(), 1 << 12);
+
+            d.clear();
+            test.check(d.empty());
+            test.equals(d.begin(), d.end());
+            d.resize_front(3);
+            d.push_back(1);
+            test.equals(d.size(), size_t(4));
+            test.equals(d.front(), 0);
+            test.equals(d.back(), 1);
+
+            Deque<std::string> strings;
+            strings.resize(200, "abc");
+            strings.resize_front(250);
+            strings.resize_for_overwrite(260);
+            test.equals(strings.front(), std::string());
+            test.equals(strings[50], std::string("abc"));
+            test.equals(strings.back(), std::string());
+            strings.clear();
+            test.check(strings.empty());
+
+            Counted<50>::counter = 0;
+            Deque<Counted<50>> counted(10);
+            try {
+                counted.resize(100);
+                test.fail();
+            } catch (CountedException&) {
+                test.equals(counted.size(), size_t(10));
+                test.equals(Counted<50>::counter, 10);
+            }
+        }),
+
+        make_test<PrettyTest>("bulk append strong guarantee", [](auto& test){
+            std::vector<Fragile> source;
+            source.reserve(1001);
+            for (int i = 0; i < 1000; ++i) {
+                source.emplace_back(10, i);
+            }
+            source.emplace_back(1, 1000);
+
+            Deque<Fragile> d(100, Fragile(10, -1));
+            auto is_intact = [&d]() {
+                return d.size() == 100 && std::all_of(d.begin(), d.end(), [](const auto& item) { return item.data == -1; });
+            };
+            try {
+                d.append_range(source);
+                test.fail();
+            } catch (...) {
+                test.check(is_intact());
+            }
+            try {
+                d.prepend_range(source);
+                test.fail();
+            } catch (...) {
+                test.check(is_intact());
+            }
+        }),
+
+        make_test<PrettyTest>("random insert and erase", [](auto& test){
+            auto check_against_std = [&test](auto deque) {
+                std::deque<int> expected;
+                std::mt19937 gen(2718);
+                for (int i = 0; i < 3000; ++i) {
+                    auto pos = static_cast<ptrdiff_t>(gen() % (expected.size() + 1));
+                    if (gen() % 3 == 0 && !expected.empty()) {
+                        pos = std::min(pos, static_cast<ptrdiff_t>(expected.size()) - 1);
+                        expected.erase(expected.begin() + pos);
+                        deque.erase(deque.begin() + pos);
+                    } else {
+                        expected.insert(expected.begin() + pos, i);
+                        deque.insert(deque.begin() + pos, i);
+                    }
+                }
+                test.equals(deque.size(), expected.size());
+                test.check(std::equal(expected.begin(), expected.end(), deque.begin()));
+            };
+            check_against_std(Deque<int>());
+            check_against_std(Deque<int, std::allocator<int>, OddChunks>());
+            check_against_std(Deque<int, CountingAllocator<int>>());
+        }),
+
+        make_test<PrettyTest>("against std::deque", [](auto& test){
+            check_against_std_deque(test, Deque<int>(), 3000);
+            check_against_std_deque(test, Deque<int, std::allocator<int>, NoSpareChunks>(), 300);
+            check_against_std_deque(test, Deque<int, std::allocator<int>, IncrementalMap>(), 3000);
+            check_against_std_deque(test, Deque<int, std::allocator<int>, TinyBackGrowth>(), 3000);
+            check_against_std_deque(test, Deque<int, std::allocator<int>, TinyFrontGrowth>(), 3000);
+        }),
+
+        make_test<PrettyTest>("range insert and erase", [](auto& test){
+            auto check_against_std = [&test](auto deque, auto make_value) {
+                using Value = decltype(make_value(0));
+                std::deque<Value> expected;
+                std::mt19937 gen(31415);
+                for (int i = 0; i < 1000; ++i) {
+                    auto pos = static_cast<ptrdiff_t>(gen() % (expected.size() + 1));
+                    // libstdc++ self-move-assigns elements on an empty insert, so insert at least one
+                    auto count = static_cast<ptrdiff_t>(1 + gen() % 40);
+                    std::vector<Value> source;
+                    for (ptrdiff_t j = 0; j < count; ++j) {
+                        source.push_back(make_value(i * 40 + static_cast<int>(j)));
+                    }
+                    switch (gen() % 4) {
+                        case 0:
+                            expected.insert(expected.begin() + pos, source.begin(), source.end());
+                            deque.insert(deque.begin() + pos, source.begin(), source.end());
+                            break;
+                        case 1:
+                            expected.insert(expected.begin() + pos, static_cast<size_t>(count), make_value(i));
+                            deque.insert(deque.begin() + pos, static_cast<size_t>(count), make_value(i));
+                            break;
+                        default:
+                            count = std::min(count, static_cast<ptrdiff_t>(expected.size()) - pos);
+                            expected.erase(expected.begin() + pos, expected.begin() + pos + count);
+                            auto it = deque.erase(deque.begin() + pos, deque.begin() + pos + count);
+                            test.check(it == deque.begin() + pos);
+                    }
+                }
+                test.equals(deque.size(), expected.size());
+                test.check(std::equal(expected.begin(), expected.end(), deque.begin(), deque.end()));
+            };
+            auto make_int = [](int i) { return i; };
+            auto make_string = [](int i) { return std::to_string(i); };
+            check_against_std(Deque<int>(), make_int);
+            check_against_std(Deque<int, std::allocator<int>, OddChunks>(), make_int);
+            check_against_std(Deque<int, CountingAllocator<int>>(), make_int);
+            check_against_std(Deque<std::string>(), make_string);
+            check_against_std(Deque<std::string, std::allocator<std::string>, OddChunks>(), make_string);
+
+            Deque<int> d;
+            d.assign({1, 2, 3});
+            d.insert(d.begin() + 1, {7, 8});
+            d.insert(d.end(), 2, d.front());
+            test.check(std::ranges::equal(d, std::array{1, 7, 8, 2, 3, 1, 1}));
+            std::istringstream stream("4 5 6");
+            d.insert_range(d.begin() + 2, std::views::istream<int>(stream));
+            test.check(std::ranges::equal(d, std::array{1, 7, 4, 5, 6, 8, 2, 3, 1, 1}));
+            auto it = d.erase(d.begin(), d.end());
+            test.check(it == d.end());
+            test.check(d.empty());
+        }),
+
+        make_test<PrettyTest>("range erase moves the shorter side", [](auto& test){
+            Deque<MoveCounted> d;
+            for (int i = 0; i < 10000; ++i) {
+                d.emplace_back(i);
+            }
+            MoveCounted::moves = 0;
+            d.erase(d.begin() + 10, d.begin() + 5000);
+            test.check(MoveCounted::moves <= 10);
+            MoveCounted::moves = 0;
+            std::vector<MoveCounted> source(100, MoveCounted(-1));
+            d.insert(d.end() - 20, std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+            test.check(MoveCounted::moves <= 100 + 3 * 120);
+            test.equals(d.size(), size_t(5110));
+            test.equals(d[9].data, 9);
+            test.equals(d[10].data, 5000);
+            test.equals(d[5089].data, -1);
+            test.equals(d[5090].data, 9980);
+        }),
+
+        make_test<PrettyTest>("erase_if", [](auto& test){
+            auto check_against_std = [&test](auto deque, auto make_value) {
+                using Value = decltype(make_value(0));
+                std::deque<Value> expected;
+                for (int i = 0; i < 5000; ++i) {
+                    expected.push_back(make_value(i % 97));
+                    deque.push_back(make_value(i % 97));
+                }
+                auto is_odd = [&make_value](const Value& item) {
+                    for (int i = 1; i < 97; i += 2) {
+                        if (item == make_value(i)) {
+                            return true;
+                        }
+                    }
+                    return false;
+                };
+                test.equals(erase_if(deque, is_odd), std::erase_if(expected, is_odd));
+                test.equals(erase(deque, make_value(10)), std::erase(expected, make_value(10)));
+                test.equals(erase(deque, make_value(1)), size_t(0));
+                test.equals(deque.size(), expected.size());
+                test.check(std::equal(expected.begin(), expected.end(), deque.begin(), deque.end()));
+                test.equals(erase_if(deque, [](const auto&) { return true; }), expected.size());
+                test.check(deque.empty());
+                deque.push_back(make_value(1));
+                test.equals(deque.size(), size_t(1));
+            };
+            auto make_int = [](int i) { return i; };
+            auto make_string = [](int i) { return std::to_string(i); };
+            check_against_std(Deque<int>(), make_int);
+            check_against_std(Deque<int, std::allocator<int>, OddChunks>(), make_int);
+            check_against_std(Deque<std::string, std::allocator<std::string>, OddChunks>(), make_string);
+
+            Deque<MoveCounted> d;
+            for (int i = 0; i < 10000; ++i) {
+                d.emplace_back(i);
+            }
+            MoveCounted::moves = 0;
+            test.equals(erase_if(d, [](const MoveCounted& item) { return item.data % 3 == 0; }), size_t(3334));
+            test.check(MoveCounted::moves <= 6666);
+            test.equals(d[0].data, 1);
+            test.equals(d[6665].data, 9998);
+        }),
+
+        make_test<PrettyTest>("shortest side shifting", [](auto& test){
+            Deque<MoveCounted> d;
+            for (int i = 0; i < 10000; ++i) {
+                d.emplace_back(i);
+            }
+            MoveCounted::moves = 0;
+            d.insert(d.begin() + 10, MoveCounted(-1));
+            test.check(MoveCounted::moves <= 12);
+            MoveCounted::moves = 0;
+            d.insert(d.end() - 10, MoveCounted(-2));
+            test.check(MoveCounted::moves <= 12);
+            MoveCounted::moves = 0;
+            d.erase(d.begin() + 5);
+            d.erase(d.end() - 5);
+            test.check(MoveCounted::moves <= 10);
+
+            test.equals(d.size(), size_t(10000));
+            test.equals(d[4].data, 4);
+            test.equals(d[5].data, 6);
+            test.equals(d[9].data, -1);
+            test.equals(d[9989].data, 9989);
+            test.equals(d[9990].data, -2);
+            test.equals(d[9995].data, 9994);
+            test.equals(d[9996].data, 9996);
+        }),
+
+        make_test<PrettyTest>("relocatable elements", [](auto& test){
+            Deque<Relocatable> d;
+            for (int i = 0; i < 300; ++i) {
+                d.emplace_back(i);
+            }
+            d.emplace(d.begin() + 100, -1);
+            d.insert(d.begin() + 250, Relocatable(-2));
+            d.erase(d.begin() + 10);
+            test.equals(d.size(), size_t(301));
+            test.equals(*d[99].data, -1);
+            test.equals(*d[100].data, 100);
+            test.equals(*d[249].data, -2);
+            test.equals(*d[10].data, 11);
+            test.equals(*d.back().data, 299);
+        }),
+
         make_test<PrettyTest>("exceptions", [](auto& test) {
             try {
                 Deque<Counted<17>> d(100);
@@ -478,6 +1314,791 @@ TestGroup create_modification_tests() {
     };
 }
 
+TestGroup create_allocator_tests() {
+    return { "allocators",
+        make_test<PrettyTest>("counting allocator", [](auto& test){
+            {
+                Deque<int, CountingAllocator<int>> d(100, 1);
+                for (int i = 0; i < 1000; ++i) {
+                    d.push_back(i);
+                    d.push_front(i);
+                }
+                Deque<int, CountingAllocator<int>> copy = d;
+                test.equals(copy.size(), size_t(2100));
+                test.check(AllocationStats::live_blocks > 0);
+            }
+            test.equals(AllocationStats::live_blocks, 0);
+        }),
+
+        make_test<PrettyTest>("pmr arena", [](auto& test){
+            std::array<std::byte, 1 << 16> buffer{};
+            std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+            pmr::Deque<int> d(&arena);
+            for (int i = 0; i < 1000; ++i) {
+                d.push_back(i);
+                d.push_front(-i);
+            }
+            test.equals(d.size(), size_t(2000));
+            test.equals(d.front(), -999);
+            test.equals(d.back(), 999);
+            test.check(d.get_allocator().resource() == &arena);
+
+            pmr::Deque<int> copy(d, &arena);
+            test.check(std::equal(d.begin(), d.end(), copy.begin()));
+        }),
+
+        make_test<PrettyTest>("chunk pool", [](auto& test){
+            using PooledDeque = Deque<int, std::allocator<int>, SmallPool>;
+            using Pool = ChunkPool<SmallPool::chunk_bytes, alignof(std::max_align_t), 4, 6>;
+            auto chunks_of = [](const PooledDeque& deque) {
+                std::set<const int*> chunks;
+                deque.for_each_segment([&chunks](std::span<const int> segment) { chunks.insert(segment.data()); });
+                return chunks;
+            };
+
+            std::set<const int*> first_chunks;
+            {
+                PooledDeque d(3 * 64, 1);
+                first_chunks = chunks_of(d);
+            }
+            PooledDeque reused(3 * 64, 2);
+            test.check(chunks_of(reused) == first_chunks);
+
+            std::thread([] {
+                PooledDeque d(20 * 64, 1);
+            }).join();
+            test.equals(Pool::reserved(), size_t(6));
+            PooledDeque from_reserve(2 * 64, 3);
+            test.equals(Pool::reserved(), size_t(4));
+
+            Deque<int, std::allocator<int>, NoPool> unpooled(1000, 4);
+            unpooled.erase(unpooled.begin(), unpooled.end() - 1);
+            test.equals(unpooled.back(), 4);
+        }),
+
+        make_test<PrettyTest>("empty deques allocate nothing", [](auto& test){
+            static_assert(std::is_nothrow_default_constructible_v<Deque<int>>);
+            static_assert(std::is_nothrow_constructible_v<Deque<int>, const std::allocator<int>&>);
+
+            auto allocated = AllocationStats::allocated;
+            {
+                Deque<int, CountingAllocator<int>> defaulted;
+                Deque<int, CountingAllocator<int>> sized(0);
+                Deque<int, CountingAllocator<int>> copy(defaulted);
+                copy = sized;
+                test.check(defaulted.empty() && sized.empty() && copy.empty());
+                test.equals(defaulted.begin(), defaulted.end());
+                test.equals(AllocationStats::allocated, allocated);
+
+                defaulted.push_front(1);
+                sized.push_back(2);
+                copy.emplace(copy.end(), 3);
+                test.equals(defaulted.front() + sized.back() + copy.back(), 6);
+            }
+            test.equals(AllocationStats::live_blocks, 0);
+        }),
+
+        make_test<PrettyTest>("memory reclamation", [](auto& test){
+            // one element per chunk, so every element is a block of its own; the map is one more
+            // and so is the empty chunk the end points to after pop_back
+            Deque<int, CountingAllocator<int>, NoSpareChunks> d;
+            for (int i = 0; i < 1000; ++i) {
+                d.push_back(i);
+                d.push_front(-i);
+            }
+            for (int i = 0; i < 990; ++i) {
+                d.pop_front();
+                d.pop_back();
+            }
+            test.equals(d.size(), size_t(20));
+            test.equals(d.front(), -9);
+            test.equals(d.back(), 9);
+            test.equals(AllocationStats::live_blocks, 22);
+            test.equals(std::accumulate(d.begin(), d.end(), 0), 0);
+
+            Deque<int, CountingAllocator<int>, KeepAllChunks> kept(100, 1);
+            for (int i = 0; i < 90; ++i) {
+                kept.pop_back();
+            }
+            test.equals(AllocationStats::live_blocks, 22 + 101);
+            kept.shrink_to_fit();
+            test.equals(AllocationStats::live_blocks, 22 + 11);
+            test.equals(kept.size(), size_t(10));
+            kept.push_front(2);
+            test.equals(kept.front(), 2);
+
+            while (!kept.empty()) {
+                kept.pop_front();
+            }
+            kept.shrink_to_fit();
+            test.equals(AllocationStats::live_blocks, 22);
+            kept.push_back(3);
+            test.equals(kept.back(), 3);
+        }),
+
+        make_test<PrettyTest>("reserve", [](auto& test){
+            Deque<int, CountingAllocator<int>> d;
+            test.equals(d.capacity_back(), size_t(0));
+            d.reserve_back(1000);
+            d.reserve_front(500);
+            test.check(d.capacity_back() >= 1000);
+            test.check(d.capacity_front() >= 500);
+
+            auto allocated = AllocationStats::allocated;
+            for (int i = 0; i < 1000; ++i) {
+                d.push_back(i);
+            }
+            for (int i = 0; i < 500; ++i) {
+                d.push_front(-i);
+            }
+            test.equals(AllocationStats::allocated, allocated);
+            test.equals(d.size(), size_t(1500));
+            test.equals(d.front(), -499);
+            test.equals(d.back(), 999);
+
+            d.reserve_back(3000);
+            auto capacity = d.capacity_back();
+            test.check(capacity >= 3000);
+            allocated = AllocationStats::allocated;
+            for (size_t i = 0; i < capacity; ++i) {
+                d.push_back(1);
+            }
+            test.equals(AllocationStats::allocated, allocated);
+            test.equals(d.capacity_back(), size_t(0));
+            d.push_back(2);
+            test.check(AllocationStats::allocated > allocated);
+            test.equals(d[499], 0);
+            test.equals(d.back(), 2);
+        }),
+
+        make_test<PrettyTest>("reclamation keeps contents", [](auto& test){
+            Deque<int, std::allocator<int>, NoSpareChunks> d;
+            std::deque<int> expected;
+            std::mt19937 gen(5);
+            for (int round = 0; round < 20; ++round) {
+                // bursts followed by drains from random ends
+                for (int i = 0; i < 500; ++i) {
+                    gen() % 2 ? (d.push_back(i), expected.push_back(i)) : (d.push_front(i), expected.push_front(i));
+                }
+                for (int i = 0; i < 480; ++i) {
+                    gen() % 2 ? (d.pop_back(), expected.pop_back()) : (d.pop_front(), expected.pop_front());
+                }
+                if (round % 5 == 0) {
+                    d.shrink_to_fit();
+                }
+            }
+            test.equals(d.size(), expected.size());
+            test.check(std::equal(d.begin(), d.end(), expected.begin()));
+        }),
+
+        make_test<PrettyTest>("chunk recycling", [](auto& test){
+            // once warmed up a queue moves its drained chunks from one end to the other
+            Deque<int, CountingAllocator<int>> fifo(1000, 0);
+            Deque<int, CountingAllocator<int>> lifo;
+            for (int i = 0; i < 1000; ++i) {
+                fifo.push_back(i);
+                fifo.pop_front();
+                lifo.push_front(i);
+            }
+            for (int i = 0; i < 1000; ++i) {
+                lifo.push_front(i);
+                lifo.pop_back();
+            }
+            auto allocated = AllocationStats::allocated;
+            long long fifo_sum = 0;
+            long long lifo_sum = 0;
+            for (int i = 0; i < 100000; ++i) {
+                fifo.push_back(i);
+                fifo_sum += fifo.front();
+                fifo.pop_front();
+                lifo.push_front(i);
+                lifo_sum += lifo.back();
+                lifo.pop_back();
+            }
+            test.equals(AllocationStats::allocated, allocated);
+            test.equals(fifo_sum, 499500 + (98999LL * 99000 / 2));
+            test.equals(lifo_sum, 499500 + (98999LL * 99000 / 2));
+            test.equals(fifo.size(), size_t(1000));
+            test.equals(fifo.front(), 99000);
+            test.equals(lifo.back(), 99000);
+        }),
+
+        make_test<PrettyTest>("steady queue", [](auto& test){
+            // one element per chunk, so the map is migrated every few hundred pushes
+            Deque<int, CountingAllocator<int>, TinyQueue> queue;
+            for (int i = 0; i < 1000; ++i) {
+                queue.push_back(i);
+            }
+            for (int i = 1000; i < 20000; ++i) {
+                queue.push_back(i);
+                queue.pop_front();
+            }
+            auto allocated = AllocationStats::allocated;
+            long long sum = 0;
+            for (int i = 20000; i < 120000; ++i) {
+                queue.push_back(i);
+                sum += queue.front();
+                queue.pop_front();
+            }
+            test.equals(AllocationStats::allocated, allocated);
+            test.equals(sum, (118999LL * 119000 - 18999LL * 19000) / 2);
+            test.equals(queue.front(), 119000);
+            test.equals(queue[999], 119999);
+        })
+    };
+}
+TestGroup create_chunk_policy_tests() {
+    return { "chunk policy",
+        make_test<SimpleTest>("static asserts", []{
+            static_assert(std::has_single_bit(BaseDeque<char>::chunk_size));
+            static_assert(BaseDeque<char>::chunk_size * sizeof(char) == DequePolicy::chunk_bytes);
+            static_assert(std::has_single_bit(BaseDeque<NotDefaultConstructible>::chunk_size));
+            static_assert(BaseDeque<Large>::chunk_size == 1);
+            static_assert(BaseDeque<int, std::allocator<int>, OddChunks>::chunk_size == 2);
+            return true;
+        }),
+
+        make_test<PrettyTest>("tiny chunks", [](auto& test){
+            Deque<int, std::allocator<int>, SingleElementChunks> d(10, 7);
+            for (int i = 0; i < 100; ++i) {
+                d.push_back(i);
+                d.push_front(-i);
+            }
+            d.insert(d.begin() + 50, 1000);
+            d.erase(d.begin() + 10);
+            test.equals(d.size(), size_t(210));
+            test.equals(d[49], 1000);
+            test.equals(d.end() - d.begin(), 210);
+            test.equals(*(d.end() - 1), 99);
+
+            std::sort(d.begin(), d.end());
+            test.check(std::is_sorted(d.cbegin(), d.cend()));
+            for (int i = 0; i < 105; ++i) {
+                d.pop_back();
+                d.pop_front();
+            }
+            test.check(d.empty());
+        }),
+
+        make_test<PrettyTest>("large elements", [](auto& test){
+            Deque<Large> d(3);
+            d.push_front(Large{});
+            d.push_back(Large{});
+            test.equals(d.size(), size_t(5));
+            test.equals(d.end() - d.begin(), 5);
+            test.equals(d[4].payload[0], 0);
+        }),
+
+        make_test<PrettyTest>("map growth presets", [](auto& test){
+            // the chunks are the same, so the difference is in the maps
+            auto grow = [&test](auto deque, bool front) {
+                auto allocated = AllocationStats::allocated;
+                for (int i = 0; i < 10000; ++i) {
+                    front ? deque.push_front(i) : deque.push_back(i);
+                }
+                test.equals(front ? deque.back() : deque.front(), 0);
+                test.equals(front ? deque.front() : deque.back(), 9999);
+                return AllocationStats::allocated - allocated;
+            };
+            auto balanced = grow(Deque<int, CountingAllocator<int>, NoSpareChunks>(), false);
+            test.check(grow(Deque<int, CountingAllocator<int>, TinyBackGrowth>(), false) < balanced);
+            test.check(grow(Deque<int, CountingAllocator<int>, TinyFrontGrowth>(), true) < balanced);
+
+            // the presets still cope with growth at the other end
+            Deque<int, std::allocator<int>, TinyBackGrowth> d;
+            for (int i = 0; i < 1000; ++i) {
+                d.push_front(i);
+            }
+            test.equals(d.front(), 999);
+            test.equals(d.size(), size_t(1000));
+        }),
+
+        make_test<PrettyTest>("incremental map", [](auto& test){
+            // one element per chunk, so the map is migrated over and over; the copies, swaps
+            // and moves catch deques in the middle of a migration
+            Deque<int, CountingAllocator<int>, IncrementalMap> d;
+            std::deque<int> expected;
+            for (int i = 0; i < 20000; ++i) {
+                i % 3 == 0 ? (d.push_front(i), expected.push_front(i)) : (d.push_back(i), expected.push_back(i));
+                if (i % 4999 == 0) {
+                    Deque<int, CountingAllocator<int>, IncrementalMap> copy(d);
+                    copy.push_back(-1);
+                    d.swap(copy);
+                    d.pop_back();
+                    copy = std::move(d);
+                    d = std::move(copy);
+                }
+            }
+            test.check(std::equal(d.begin(), d.end(), expected.begin(), expected.end()));
+
+            // a FIFO walks through the map and migrates by shifts
+            for (int i = 0; i < 100000; ++i) {
+                d.push_back(i);
+                d.pop_front();
+                expected.push_back(i);
+                expected.pop_front();
+            }
+            test.check(std::equal(d.begin(), d.end(), expected.begin(), expected.end()));
+            auto live_blocks = AllocationStats::live_blocks;
+            d.clear();
+            d.shrink_to_fit();
+            test.check(AllocationStats::live_blocks < live_blocks - 20000);
+        }),
+
+        make_test<PrettyTest>("mapped chunks", [](auto& test){
+            // one element per chunk, enough of them for a map of its own mapping
+            using Mapped = BaseDeque<int, std::allocator<int>, MappedTinyChunks>::Mapped;
+            Deque<int, std::allocator<int>, MappedTinyChunks> d;
+            std::deque<int> expected;
+            for (int i = 0; i < 300000; ++i) {
+                i % 4 == 0 ? (d.push_front(i), expected.push_front(i)) : (d.push_back(i), expected.push_back(i));
+            }
+            test.check(std::equal(d.begin(), d.end(), expected.begin(), expected.end()));
+            test.equals(Mapped::live(), d.size());
+            // chunks pushed one after the other lie in the same region
+            auto first = reinterpret_cast<uintptr_t>(&d[d.size() - 1000]);
+            auto last = reinterpret_cast<uintptr_t>(&d.back());
+            test.check((first ^ last) < Mapped::region_bytes);
+
+            auto regions = Mapped::regions();
+            d.clear();
+            d.shrink_to_fit();
+            test.equals(Mapped::live(), size_t(0));
+            // the emptied regions are reused rather than mapped again
+            for (int i = 0; i < 300000; ++i) {
+                d.push_back(i);
+            }
+            test.equals(Mapped::regions(), regions);
+            test.equals(d[123456], 123456);
+        
+            // the last region to drain keeps its pages, what was written there is still there
+            using WarmMapped = BaseDeque<int, std::allocator<int>, MappedChunkPolicy>::Mapped;
+            Deque<int, std::allocator<int>, MappedChunkPolicy> sevens(100'000, 7);
+            sevens.clear();
+            sevens.shrink_to_fit();
+            test.equals(WarmMapped::live(), size_t(0));
+            auto* chunk = static_cast<int*>(WarmMapped::acquire());
+            // past the free list link at its start
+            test.equals(chunk[2], 7);
+            WarmMapped::release(chunk);
+        })
+    };
+}
+
+TestGroup create_small_deque_tests() {
+    return { "small deque",
+        make_test<SimpleTest>("static asserts", []{
+            CheckIter<SmallDeque<int, 4>::iterator, int> iter;
+            std::ignore = iter;
+            CheckIter<SmallDeque<int, 4>::const_iterator, const int> const_iter;
+            std::ignore = const_iter;
+            static_assert(std::is_convertible_v<SmallDeque<int, 4>::iterator, SmallDeque<int, 4>::const_iterator>);
+            static_assert(!std::is_convertible_v<SmallDeque<int, 4>::const_iterator, SmallDeque<int, 4>::iterator>);
+            static_assert(std::ranges::random_access_range<SmallDeque<int, 4>>);
+            static_assert(SmallDeque<int, 5>::inline_capacity == 8);
+            static_assert(std::is_nothrow_default_constructible_v<SmallDeque<int, 4>>);
+            static_assert(std::is_nothrow_move_constructible_v<SmallDeque<int, 4>>);
+            static_assert(std::is_nothrow_move_assignable_v<SmallDeque<int, 4>>);
+            static_assert(std::is_nothrow_move_constructible_v<pmr::SmallDeque<int, 4>>);
+            static_assert(!std::is_nothrow_move_assignable_v<pmr::SmallDeque<int, 4>>);
+            return true;
+        }),
+
+        make_test<PrettyTest>("stays inline", [](auto& test){
+            auto allocated = AllocationStats::allocated;
+            SmallDeque<int, 8, CountingAllocator<int>> queue;
+            for (int i = 0; i < 100'000; ++i) {
+                queue.push_back(i);
+                if (queue.size() > 5) {
+                    queue.pop_front();
+                }
+            }
+            queue.push_front(-1);
+            queue.insert(queue.begin() + 2, 7);
+            test.equals(queue.size(), size_t(7));
+            test.equals(queue.front(), -1);
+            test.equals(queue[2], 7);
+            test.equals(queue.back(), 99'999);
+            test.check(queue.is_inline());
+            test.equals(AllocationStats::allocated, allocated);
+
+            queue.push_back(1);
+            queue.push_back(2);
+            test.check(!queue.is_inline());
+            test.equals(queue.size(), size_t(9));
+            test.equals(queue.back(), 2);
+            test.equals(queue[2], 7);
+            test.check(AllocationStats::allocated > allocated);
+
+            queue.erase(queue.begin(), queue.begin() + 4);
+            queue.shrink_to_fit();
+            test.check(queue.is_inline());
+            test.equals(queue.front(), 99'997);
+        }),
+
+        make_test<PrettyTest>("against std::deque", [](auto& test){
+            check_against_std_deque(test, SmallDeque<int, 16>(), 30);
+        }),
+
+        make_test<PrettyTest>("copy, move and swap", [](auto& test){
+            SmallDeque<std::string, 4> inline_strings(3, "a");
+            SmallDeque<std::string, 4> spilled_strings(10, "b");
+            test.check(inline_strings.is_inline() && !spilled_strings.is_inline());
+
+            auto copy = spilled_strings;
+            copy = inline_strings;
+            test.equals(copy.size(), size_t(3));
+            test.check(copy.is_inline());
+
+            copy = std::move(spilled_strings);
+            test.equals(copy.size(), size_t(10));
+            test.equals(copy.at(9), std::string("b"));
+            test.check(spilled_strings.empty());
+
+            copy.swap(inline_strings);
+            test.equals(copy.size(), size_t(3));
+            test.equals(inline_strings.size(), size_t(10));
+            test.equals(copy.front(), std::string("a"));
+
+            SmallDeque<std::string, 4> moved(std::move(copy));
+            test.equals(moved.back(), std::string("a"));
+            test.check(copy.empty());
+
+            moved.resize(6, "c");
+            test.equals(erase(moved, std::string("a")), size_t(3));
+            test.equals(moved.size(), size_t(3));
+            moved.clear();
+            test.check(moved.empty());
+
+            try {
+                std::ignore = moved.at(0);
+                test.fail();
+            } catch (const std::out_of_range&) {
+            }
+        })
+    };
+}
+
+constexpr int static_deque_sum() {
+    StaticDeque<int, 8> d;
+    for (int i = 1; i <= 4; ++i) {
+        d.push_back(i);
+        d.push_front(-2 * i);
+    }
+    d.pop_front();
+    d.insert(d.begin() + 3, 100);
+    d.erase(d.begin());
+    return std::accumulate(d.begin(), d.end(), 0) + static_cast<int>(d.size());
+}
+
+TestGroup create_static_deque_tests() {
+    return { "static deque",
+        make_test<SimpleTest>("static asserts", []{
+            CheckIter<StaticDeque<int, 4>::iterator, int> iter;
+            std::ignore = iter;
+            CheckIter<StaticDeque<int, 4>::const_iterator, const int> const_iter;
+            std::ignore = const_iter;
+            static_assert(std::ranges::random_access_range<StaticDeque<int, 4>>);
+            static_assert(std::ranges::random_access_range<const StaticDeque<int, 4>>);
+            static_assert(StaticDeque<int, 16>::capacity() == 16);
+            // -4, -2, 100, 1, 2, 3, 4 and their count
+            static_assert(static_deque_sum() == 104 + 7);
+            return true;
+        }),
+
+        make_test<PrettyTest>("against std::deque", [](auto& test){
+            check_against_std_deque(test, StaticDeque<int, 64>(), 64);
+        }),
+
+        make_test<PrettyTest>("full", [](auto& test){
+            StaticDeque<std::string, 4> d(3, "x");
+            d.push_front("a");
+            test.check(d.full());
+            try {
+                d.push_back("b");
+                test.fail();
+            } catch (const std::length_error&) {
+                test.equals(d.size(), size_t(4));
+            }
+            d.pop_back();
+            d.emplace_back(2, 'y');
+            test.equals(d.back(), std::string("yy"));
+            test.equals(d.at(0), std::string("a"));
+            try {
+                std::ignore = d.at(4);
+                test.fail();
+            } catch (const std::out_of_range&) {
+            }
+        }),
+
+        make_test<PrettyTest>("copy, move and swap", [](auto& test){
+            StaticDeque<std::string, 8> first;
+            for (int i = 0; i < 20; ++i) {
+                // wraps around the ring a few times
+                first.push_back(std::to_string(i));
+                if (first.size() > 5) {
+                    first.pop_front();
+                }
+            }
+            StaticDeque<std::string, 8> second(first);
+            test.check(std::equal(first.begin(), first.end(), second.begin(), second.end()));
+            second.resize(2);
+            first.swap(second);
+            test.equals(first.size(), size_t(2));
+            test.equals(second.front(), std::string("15"));
+
+            StaticDeque<std::string, 8> moved(std::move(second));
+            test.equals(moved.size(), size_t(5));
+            test.equals(erase(moved, std::string("17")), size_t(1));
+            moved = first;
+            test.equals(moved.back(), std::string("16"));
+            moved.clear();
+            test.check(moved.empty());
+        }),
+
+        make_test<PrettyTest>("throwing move", [](auto& test){
+            using Element = Counted<5>;
+            StaticDeque<Element, 8> source(3);
+            try {
+                StaticDeque<Element, 8> first(source);
+                test.fail();
+            } catch (const CountedException&) {
+            }
+            test.equals(Element::counter, 3);
+            source.pop_back();
+            StaticDeque<Element, 8> first(source);
+            try {
+                StaticDeque<Element, 8> second(std::move(source));
+                test.fail();
+            } catch (const CountedException&) {
+            }
+            test.equals(Element::counter, 4);
+        })
+    };
+}
+
+TestGroup create_realtime_tests() {
+    return { "real-time deque",
+        make_test<PrettyTest>("budget", [](auto& test){
+            RealtimeArena arena(RealtimeArena::budget_for<int>(1000));
+            RealtimeDeque<int> d(&arena);
+            int pushed = 0;
+            for (; pushed < 100'000 && d.try_push_back(pushed); ++pushed) {
+            }
+            test.check(pushed >= 1000);
+            test.check(pushed < 100'000);
+            try {
+                d.push_back(-1);
+                test.fail();
+            } catch (const std::bad_alloc&) {
+                test.equals(d.size(), size_t(pushed));
+            }
+            test.equals(d.back(), pushed - 1);
+
+            // pops give the storage back, to the other end as well
+            for (int i = 0; i < 500; ++i) {
+                d.pop_back();
+            }
+            for (int i = 1; i <= 300; ++i) {
+                test.check(d.try_push_front(-i));
+            }
+            test.equals(d.front(), -300);
+            test.equals(d[300], 0);
+            d.clear();
+            d.shrink_to_fit();
+            test.equals(arena.free_chunks(), RealtimeArena::budget_for<int>(1000).chunks);
+            test.equals(arena.free_maps(), size_t(2));
+
+            try {
+                RealtimeArena locked({sizeof(int), 16, 16, 2}, true);
+                test.check(locked.is_locked());
+            } catch (const std::system_error&) {
+                // RLIMIT_MEMLOCK may not allow it
+            }
+        }),
+
+        make_test<PrettyTest>("no allocations while running", [](auto& test){
+            {
+                AllocationTrap trap;
+                std::vector<int> vec(10);
+                auto arr = std::make_unique<int[]>(10);
+                test.equals(trap.allocations(), 2LL);
+            }
+
+            // bursts of pushes and pops at either end that keep at most `capacity` elements,
+            // so the elements drift through the map in both directions
+            constexpr int capacity = 5000;
+            std::mt19937 gen(7);
+            std::vector<std::pair<int, int>> bursts;
+            for (int size = 0; bursts.size() < 2000;) {
+                auto kind = static_cast<int>(gen() % 4);
+                auto room = static_cast<unsigned>(kind < 2 ? capacity - size : size);
+                auto count = static_cast<int>(gen() % (room + 1));
+                size += kind < 2 ? count : -count;
+                bursts.emplace_back(kind, count);
+            }
+
+            // the arena is all the memory the deque has, every chunk and map it takes comes out
+            // of the free lists set aside at construction and goes back into them
+            auto budget = RealtimeArena::budget_for<std::array<int, 3>>(capacity);
+            RealtimeArena arena(budget);
+            RealtimeDeque<std::array<int, 3>> d(&arena);
+            std::deque<std::array<int, 3>> expected;
+            bool ok = true;
+            size_t fewest_maps = budget.maps;
+            long long caught = 0;
+            {
+                // the arena is warm from its construction, nothing may reach the global heap now
+                AllocationTrap trap;
+                for (auto [kind, count] : bursts) {
+                    for (int i = 0; i < count; ++i) {
+                        std::array<int, 3> val{kind, i, count};
+                        if (kind < 2) {
+                            ok &= kind == 0 ? d.try_push_back(val) : d.try_push_front(val);
+                        } else {
+                            kind == 2 ? d.pop_back() : d.pop_front();
+                        }
+                        fewest_maps = std::min(fewest_maps, arena.free_maps());
+                    }
+                }
+                caught = trap.allocations();
+            }
+            test.equals(caught, 0LL);
+            test.check(ok);
+            test.check(fewest_maps < budget.maps);
+
+            for (auto [kind, count] : bursts) {
+                for (int i = 0; i < count; ++i) {
+                    std::array<int, 3> val{kind, i, count};
+                    if (kind < 2) {
+                        kind == 0 ? expected.push_back(val) : expected.push_front(val);
+                    } else {
+                        kind == 2 ? expected.pop_back() : expected.pop_front();
+                    }
+                }
+            }
+            test.check(std::equal(d.begin(), d.end(), expected.begin(), expected.end()));
+            d.clear();
+            d.shrink_to_fit();
+            test.equals(arena.free_chunks(), budget.chunks);
+            test.equals(arena.free_maps(), budget.maps);
+        }),
+
+        make_test<PrettyTest>("maps as large as chunks", [](auto& test){
+            // a map of 64 slots takes as many bytes as a chunk of 128 ints, it still comes
+            // from the map blocks
+            auto budget = RealtimeArena::budget_for<int>(100'000);
+            RealtimeArena arena(budget);
+            RealtimeDeque<int> d(&arena);
+            constexpr size_t chunks = 63;
+            d.reserve_back(chunks * 128);
+            test.equals(arena.free_chunks(), budget.chunks - chunks);
+            test.equals(arena.free_maps(), budget.maps - 1);
+            for (int i = 0; i < 63 * 128; ++i) {
+                test.check(d.try_push_back(i));
+            }
+            test.equals(arena.free_chunks(), budget.chunks - chunks);
+            test.equals(d[1000], 1000);
+        })
+    };
+}
+
+TestGroup create_parallel_tests() {
+    return { "parallel",
+        make_test<PrettyTest>("thread pool", [](auto& test){
+            ThreadPool pool(4);
+            test.equals(pool.size(), size_t(4));
+            std::vector<int> hits(1000);
+            pool.run(hits.size(), [&hits](size_t i) { ++hits[i]; });
+            test.check(std::all_of(hits.begin(), hits.end(), [](int hit) { return hit == 1; }));
+            pool.run(0, [](size_t) {});
+            try {
+                pool.run(10, [](size_t i) {
+                    if (i == 7) {
+                        throw std::runtime_error("task failed");
+                    }
+                });
+                test.fail();
+            } catch (const std::runtime_error&) {
+            }
+            pool.run(hits.size(), [&hits](size_t i) { ++hits[i]; });
+            test.check(std::all_of(hits.begin(), hits.end(), [](int hit) { return hit == 2; }));
+        }),
+        make_test<PrettyTest>("for_each, transform and reduce", [](auto& test){
+            ThreadPool pool(4);
+            Deque<int64_t, std::allocator<int64_t>, OddChunks> d(100'001, 0);
+            parallel::for_each(d.begin(), d.end(), [](int64_t& item) { item = 3; }, pool);
+            test.equals(std::count(d.begin(), d.end(), 3), 100'001);
+
+            std::iota(d.begin(), d.end(), 0);
+            Deque<int64_t> squares(d.size());
+            auto out = parallel::transform(d.cbegin(), d.cend(), squares.begin(),
+                                           [](int64_t item) { return item * item; }, pool);
+            test.check(out == squares.end());
+            test.equals(squares[1000], int64_t(1'000'000));
+            test.equals(parallel::reduce(d.begin(), d.end(), int64_t(5), std::plus<>(), pool),
+                        std::accumulate(d.begin(), d.end(), int64_t(5)));
+
+            std::vector<int64_t> vec(d.begin(), d.end());
+            test.equals(parallel::reduce(vec.begin(), vec.end(), int64_t(0), std::plus<>(), pool),
+                        std::accumulate(d.begin(), d.end(), int64_t(0)));
+            test.equals(parallel::reduce(d.end(), d.end(), int64_t(7)), int64_t(7));
+            Deque<std::string, std::allocator<std::string>, OddChunks> words;
+            for (int i = 0; i < 20; ++i) {
+                words.push_back(std::to_string(i));
+            }
+            test.equals(parallel::reduce(words.begin(), words.end(), std::string(">"), std::plus<>(), pool),
+                        std::string(">012345678910111213141516171819"));
+        }),
+        make_test<PrettyTest>("sort", [](auto& test){
+            ThreadPool pool(3);
+            std::mt19937 gen(5);
+            Deque<int> d;
+            for (int i = 0; i < 50'000; ++i) {
+                d.push_back(static_cast<int>(gen() % 10'000));
+            }
+            std::vector<int> expected(d.begin(), d.end());
+            std::sort(expected.begin(), expected.end(), std::greater<>());
+            parallel::sort(d.begin() + 1, d.end(), std::greater<>(), pool);
+            parallel::sort(d.begin(), d.end(), std::greater<>(), pool);
+            test.check(std::equal(expected.begin(), expected.end(), d.begin(), d.end()));
+            parallel::sort(d.begin(), d.end());
+            test.check(std::is_sorted(d.begin(), d.end()));
+
+            Deque<int> tiny(3, 1);
+            tiny[0] = 2;
+            parallel::sort(tiny.begin(), tiny.end(), std::less<>(), pool);
+            test.check(std::is_sorted(tiny.begin(), tiny.end()));
+
+            // many equal keys across the slices of a merge, no element lost or duplicated
+            Deque<std::pair<int, int>, std::allocator<std::pair<int, int>>, OddChunks> pairs;
+            for (int i = 0; i < 20'000; ++i) {
+                pairs.emplace_back(static_cast<int>(gen() % 7), i);
+            }
+            auto by_key = [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; };
+            parallel::sort(pairs.begin(), pairs.end(), by_key, pool);
+            test.check(std::is_sorted(pairs.begin(), pairs.end(), by_key));
+            std::vector<int> ids;
+            for (const auto& item : pairs) {
+                ids.push_back(item.second);
+            }
+            std::sort(ids.begin(), ids.end());
+            test.check(std::ranges::equal(ids, std::views::iota(0, 20'000)));
+            Deque<std::string> words;
+            for (int i = 0; i < 5'000; ++i) {
+                words.push_back(std::to_string(gen()));
+            }
+            parallel::sort(words.begin(), words.end(), std::less<>(), pool);
+            test.check(std::is_sorted(words.begin(), words.end()));
+            Deque<NotDefaultConstructible> fixed;
+            for (int i = 0; i < 5'000; ++i) {
+                fixed.emplace_back(static_cast<int>(gen() % 100));
+            }
+            parallel::sort(fixed.begin(), fixed.end(), std::less<>(), pool);
+            test.check(std::is_sorted(fixed.begin(), fixed.end()));
+        })
+    };
+}
 
 int main() {
     groups_t groups {};
@@ -485,6 +2106,12 @@ int main() {
     groups.push_back(create_access_tests());
     groups.push_back(create_iterator_tests());
     groups.push_back(create_modification_tests());
+    groups.push_back(create_allocator_tests());
+    groups.push_back(create_chunk_policy_tests());
+    groups.push_back(create_small_deque_tests());
+    groups.push_back(create_static_deque_tests());
+    groups.push_back(create_realtime_tests());
+    groups.push_back(create_parallel_tests());
 
     bool res = true;
     for (auto& g : groups) {